@@ -0,0 +1,68 @@
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+void LatencyHistogram::Record(Duration latency) {
+    ++counts_[GetBucket(latency)];
+    ++count_;
+}
+
+void LatencyHistogram::Remove(Duration latency) {
+    --counts_[GetBucket(latency)];
+    --count_;
+}
+
+void LatencyHistogram::AddBucketCount(int bucket, uint64_t count) {
+    counts_[bucket] += count;
+    count_ += count;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+    for (int bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+        counts_[bucket] += other.counts_[bucket];
+    }
+    count_ += other.count_;
+}
+
+uint64_t LatencyHistogram::GetCount() const {
+    return count_;
+}
+
+LatencyHistogram::Duration LatencyHistogram::GetQuantile(double quantile) const {
+    if (count_ == 0) {
+        return Duration{0};
+    }
+    // rank of the value, from 1 to count_
+    const double clamped_quantile = min(max(quantile, 0.0), 1.0);
+    const uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(ceil(clamped_quantile * count_)));
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+        seen += counts_[bucket];
+        if (seen >= rank) {
+            return Duration{static_cast<Duration::rep>(GetBucketMaxValue(bucket))};
+        }
+    }
+    return Duration{static_cast<Duration::rep>(GetBucketMaxValue(BUCKET_COUNT - 1))};
+}
+
+int LatencyHistogram::GetBucket(Duration latency) {
+    const uint64_t value = static_cast<uint64_t>(max<Duration::rep>(latency.count(), 0));
+    if (value < SUB_BUCKET_COUNT) {
+        return static_cast<int>(value);
+    }
+    // the value is shifted to [SUB_BUCKET_COUNT, 2 * SUB_BUCKET_COUNT)
+    const int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKET_COUNT + static_cast<int>((value >> shift) - SUB_BUCKET_COUNT);
+}
+
+uint64_t LatencyHistogram::GetBucketMaxValue(int bucket) {
+    if (bucket < SUB_BUCKET_COUNT) {
+        return bucket;
+    }
+    const int shift = bucket / SUB_BUCKET_COUNT - 1;
+    const uint64_t sub_bucket = bucket % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+    return (sub_bucket << shift) + ((uint64_t{1} << shift) - 1);
+}
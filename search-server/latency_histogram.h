@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+// Histogram of durations in the manner of HDR histograms: a power of two
+// range is split into SUB_BUCKET_COUNT buckets, so a value is recorded in
+// O(1) into a fixed array and quantiles are found with a relative error of
+// at most 1 / SUB_BUCKET_COUNT
+class LatencyHistogram {
+public:
+    using Duration = std::chrono::nanoseconds;
+
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static constexpr int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+    // Buckets are public for counters kept elsewhere (see StageLatencyRegistry)
+    static int GetBucket(Duration latency);
+
+    void AddBucketCount(int bucket, uint64_t count);
+
+    void Record(Duration latency);
+
+    // Remove a recorded value, so a histogram may follow a sliding window
+    void Remove(Duration latency);
+
+    void Merge(const LatencyHistogram& other);
+
+    uint64_t GetCount() const;
+
+    // The greatest value of the bucket of the quantile (from 0 to 1) of
+    // recorded values; 0 if the histogram is empty
+    Duration GetQuantile(double quantile) const;
+
+private:
+    std::array<uint64_t, BUCKET_COUNT> counts_{};
+    uint64_t count_ = 0;
+
+    static uint64_t GetBucketMaxValue(int bucket);
+};
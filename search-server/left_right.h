@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib> // size_t
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// Left-right concurrency control: two instances of T, readers use one of them
+// while the writer changes the other one; then readers are switched to the
+// changed instance and the change is repeated on the other one as soon as its
+// last reader leaves. Readers never block and never see a change in progress;
+// writers are serialized and wait for readers to leave. Changes must be
+// deterministic, so both instances stay equal.
+template <typename T>
+class LeftRight {
+public:
+    LeftRight(T first, T second)
+        : instances_{std::move(first), std::move(second)} {
+    }
+
+    LeftRight(const LeftRight&) = delete;
+    LeftRight& operator=(const LeftRight&) = delete;
+
+    // Return func(const T&)
+    template <typename Func>
+    auto Read(Func func) const;
+
+    // Call func(T&) for both instances; if the first call throws, nothing
+    // is published
+    template <typename Func>
+    void Write(Func func);
+
+private:
+    // Readers of a version are counted in slots chosen by thread, so
+    // readers of different threads rarely share a counter
+    class ReadIndicator {
+    public:
+        size_t Arrive() {
+            const size_t slot = std::hash<std::thread::id>{}(std::this_thread::get_id()) % SLOT_COUNT;
+            slots_[slot].readers.fetch_add(1);
+            return slot;
+        }
+
+        void Depart(size_t slot) {
+            slots_[slot].readers.fetch_sub(1);
+        }
+
+        void WaitEmpty() const {
+            for (const Slot& slot : slots_) {
+                while (slot.readers.load() != 0) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+    private:
+        static constexpr size_t SLOT_COUNT = 16;
+
+        struct alignas(64) Slot {
+            std::atomic<int> readers{0};
+        };
+
+        Slot slots_[SLOT_COUNT];
+    };
+
+    T instances_[2];
+    // instance for new readers
+    std::atomic<int> read_instance_{0};
+    // readers are counted in the indicator of the current version
+    std::atomic<int> version_{0};
+    mutable ReadIndicator indicators_[2];
+    std::mutex write_mutex_;
+};
+
+template <typename T>
+template <typename Func>
+auto LeftRight<T>::Read(Func func) const {
+    ReadIndicator& indicator = indicators_[version_.load()];
+    // the reader leaves even if func throws
+    struct Departure {
+        ReadIndicator& indicator;
+        size_t slot;
+        ~Departure() {
+            indicator.Depart(slot);
+        }
+    } departure{indicator, indicator.Arrive()};
+    return func(instances_[read_instance_.load()]);
+}
+
+template <typename T>
+template <typename Func>
+void LeftRight<T>::Write(Func func) {
+    std::lock_guard guard(write_mutex_);
+    const int read_instance = read_instance_.load();
+    func(instances_[1 - read_instance]);
+    read_instance_.store(1 - read_instance);
+    // readers which could have read read_instance before the switch are
+    // counted in the indicator of the current version; new readers arrive
+    // to the other indicator
+    const int version = version_.load();
+    indicators_[1 - version].WaitEmpty();
+    version_.store(1 - version);
+    indicators_[version].WaitEmpty();
+    func(instances_[read_instance]);
+}
@@ -10,6 +10,7 @@
 #include "read_input_functions.h"
 #include "request_queue.h"
 #include "search_server.h"
+#include "stage_latency.h"
 #include "string_processing.h"
 #include "remove_duplicates.h"
 #include "testing.h"
@@ -68,9 +69,11 @@ void FindTopDocuments(const SearchServer& search_server, const string& raw_query
 void MatchDocuments(const SearchServer& search_server, const string& query) {
     try {
         cout << "Матчинг документов по запросу: "s << query << endl;
-        for (const auto document_id : search_server) {
-            const auto [words, status] = search_server.MatchDocument(query, document_id);
-            PrintMatchDocumentResult(document_id, words, status);
+        const vector<int> document_ids = search_server.GetDocumentIds();
+        const auto results = search_server.MatchDocuments(query, document_ids);
+        for (size_t i = 0; i < document_ids.size(); ++i) {
+            const auto& [words, status] = results[i];
+            PrintMatchDocumentResult(document_ids[i], words, status);
         }
     } catch (const exception& e) {
         cout << "Ошибка матчинга документов на запрос "s << query << ": "s << e.what() << endl;
@@ -152,4 +155,8 @@ int main() {
 
     TEST(seq);
     TEST(par);
+
+#ifdef ENABLE_STAGE_LATENCY
+    StageLatencyRegistry::Instance().Dump(cerr);
+#endif
 }
@@ -0,0 +1,384 @@
+#include "posting_list.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include "snapshot.h"
+
+using namespace std;
+
+namespace {
+
+// bytes after the last block, so that any value is read with one 8-byte load
+const size_t PADDING = sizeof(uint64_t);
+
+int GetBitWidth(uint32_t max_value) {
+    int bits = 0;
+    while (bits < 32 && (max_value >> bits) != 0) {
+        ++bits;
+    }
+    return bits;
+}
+
+size_t GetPackedBytes(int size, int bits) {
+    return (static_cast<size_t>(size) * bits + 7) / 8;
+}
+
+void PackBits(const uint32_t* values, int size, int bits, vector<uint8_t>& bytes) {
+    const size_t start = bytes.size();
+    bytes.resize(start + GetPackedBytes(size, bits) + PADDING, 0);
+    for (int i = 0; i < size; ++i) {
+        const size_t bit = static_cast<size_t>(i) * bits;
+        uint8_t* at = bytes.data() + start + bit / 8;
+        uint64_t word;
+        memcpy(&word, at, sizeof(word));
+        word |= static_cast<uint64_t>(values[i]) << (bit % 8);
+        memcpy(at, &word, sizeof(word));
+    }
+    bytes.resize(start + GetPackedBytes(size, bits));
+}
+
+// Read the value with the given index; 8 bytes after it must be readable
+template <int BITS>
+uint32_t UnpackValue(const uint8_t* bytes, int index) {
+    constexpr uint64_t MASK = (uint64_t{1} << BITS) - 1;
+    const size_t bit = static_cast<size_t>(index) * BITS;
+    uint64_t word;
+    memcpy(&word, bytes + bit / 8, sizeof(word));
+    return static_cast<uint32_t>((word >> (bit % 8)) & MASK);
+}
+
+// Read eight values, which take exactly BITS bytes
+template <int BITS, size_t... I>
+void UnpackEight(const uint8_t* bytes, uint32_t base, uint32_t* values,
+                 std::index_sequence<I...>) {
+    ((values[I] = base + UnpackValue<BITS>(bytes, I)), ...);
+}
+
+// Read size values and add base to them; 8 bytes after the packed values
+// must be readable. Bit width is a template parameter, so that shifts and
+// masks are constants
+template <int BITS>
+void UnpackBits(const uint8_t* bytes, int size, uint32_t base, uint32_t* values) {
+    int i = 0;
+    for (; i + 8 <= size; i += 8, bytes += BITS) {
+        UnpackEight<BITS>(bytes, base, values + i, std::make_index_sequence<8>{});
+    }
+    for (int j = 0; i < size; ++i, ++j) {
+        values[i] = base + UnpackValue<BITS>(bytes, j);
+    }
+}
+
+template <int... BITS>
+void UnpackBits(const uint8_t* bytes, int size, int bits, uint32_t base, uint32_t* values,
+                std::integer_sequence<int, BITS...>) {
+    using Unpack = void (*)(const uint8_t*, int, uint32_t, uint32_t*);
+    static constexpr Unpack UNPACK[] = {&UnpackBits<BITS + 1>...};
+    UNPACK[bits - 1](bytes, size, base, values);
+}
+
+void UnpackBits(const uint8_t* bytes, int size, int bits, uint32_t base, uint32_t* values) {
+    if (bits == 0) {
+        fill(values, values + size, base);
+    } else {
+        UnpackBits(bytes, size, bits, base, values, std::make_integer_sequence<int, 32>{});
+    }
+}
+
+// Read the value with the given index and run-time bit width
+uint32_t UnpackValue(const uint8_t* bytes, int index, int bits) {
+    const uint64_t mask = (uint64_t{1} << bits) - 1;
+    const size_t bit = static_cast<size_t>(index) * bits;
+    uint64_t word;
+    memcpy(&word, bytes + bit / 8, sizeof(word));
+    return static_cast<uint32_t>((word >> (bit % 8)) & mask);
+}
+
+} // namespace
+
+void PostingList::Add(int ordinal, int term_count, double term_freq) {
+    assert(term_count > 0);
+    assert(tail_.empty() ? blocks_.empty() || blocks_.back().last_ordinal < ordinal
+                         : tail_.back().ordinal < ordinal);
+    tail_.push_back({ordinal, term_count});
+    ++size_;
+    max_term_freq_ = max(max_term_freq_, term_freq);
+    if (tail_.size() == BLOCK_SIZE) {
+        SealTail();
+    }
+}
+
+PostingList::Cursor
+PostingList::LowerBound(int ordinal) const {
+    Cursor cursor(*this, FindBlock(0, ordinal));
+    cursor.Seek(ordinal);
+    return cursor;
+}
+
+double PostingList::GetMaxTermFreq() const {
+    return max_term_freq_;
+}
+
+size_t PostingList::size() const {
+    return size_;
+}
+
+bool PostingList::empty() const {
+    return size_ == 0;
+}
+
+void PostingList::Save(SnapshotWriter& writer) const {
+    writer.Write(static_cast<uint64_t>(size_));
+    writer.Write(max_term_freq_);
+    // field by field, so that struct padding isn't written
+    writer.Write(static_cast<uint64_t>(blocks_.size()));
+    for (const BlockInfo& info : blocks_) {
+        writer.Write(info.first_ordinal);
+        writer.Write(info.last_ordinal);
+        writer.Write(info.offset);
+        writer.Write(info.size);
+        writer.Write(info.offset_bits);
+        writer.Write(info.count_bits);
+    }
+    writer.Write(static_cast<uint64_t>(mapping_ ? mapped_size_ : data_.size()));
+    writer.Write(GetData(), mapping_ ? mapped_size_ : data_.size());
+    writer.WriteVector(tail_);
+}
+
+PostingList PostingList::Load(SnapshotReader& reader, int ordinal_count) {
+    PostingList list;
+    list.size_ = static_cast<size_t>(reader.Read<uint64_t>());
+    list.max_term_freq_ = reader.Read<double>();
+    // not reserved: a corrupted count would allocate before reads fail
+    const uint64_t block_count = reader.Read<uint64_t>();
+    for (uint64_t block = 0; block < block_count; ++block) {
+        BlockInfo info;
+        info.first_ordinal = reader.Read<int>();
+        info.last_ordinal = reader.Read<int>();
+        info.offset = reader.Read<uint32_t>();
+        info.size = reader.Read<uint8_t>();
+        info.offset_bits = reader.Read<uint8_t>();
+        info.count_bits = reader.Read<uint8_t>();
+        list.blocks_.push_back(info);
+    }
+    list.mapped_size_ = static_cast<size_t>(reader.Read<uint64_t>());
+    list.mapped_data_ = reader.ReadBytes(list.mapped_size_);
+    list.mapping_ = reader.GetFile();
+    list.tail_ = reader.ReadVector<Posting>();
+    if (!list.IsValid(ordinal_count)) {
+        throw runtime_error("Corrupted snapshot: invalid posting list"s);
+    }
+    return list;
+}
+
+void PostingList::DetachMapping() {
+    if (mapping_) {
+        data_.assign(mapped_data_, mapped_data_ + mapped_size_);
+        mapping_.reset();
+        mapped_data_ = nullptr;
+        mapped_size_ = 0;
+    }
+}
+
+int PostingList::DecodeBlock(size_t block, uint32_t* ordinals, uint32_t* counts) const {
+    const BlockInfo& info = blocks_[block];
+    const uint8_t* bytes = GetData() + info.offset;
+    // offsets from the first ordinal are independent, so no prefix sums
+    UnpackBits(bytes, info.size, info.offset_bits,
+               static_cast<uint32_t>(info.first_ordinal), ordinals);
+    // counts minus one
+    UnpackBits(bytes + GetPackedBytes(info.size, info.offset_bits),
+               info.size, info.count_bits, 1, counts);
+    return info.size;
+}
+
+int PostingList::GetOrdinal(const BlockInfo& info, int index) const {
+    return info.first_ordinal
+        + static_cast<int>(UnpackValue(GetData() + info.offset, index, info.offset_bits));
+}
+
+int PostingList::GetTermCount(const BlockInfo& info, int index) const {
+    const uint8_t* counts = GetData() + info.offset + GetPackedBytes(info.size, info.offset_bits);
+    return 1 + static_cast<int>(UnpackValue(counts, index, info.count_bits));
+}
+
+size_t PostingList::FindBlock(size_t first_block, int ordinal) const {
+    return partition_point(blocks_.begin() + first_block, blocks_.end(),
+        [ordinal](const BlockInfo& info) {
+            return info.last_ordinal < ordinal;
+        }) - blocks_.begin();
+}
+
+PostingList::BlockInfo
+PostingList::EncodeBlock(const uint32_t* ordinals, const uint32_t* counts, int size,
+                         vector<uint8_t>& bytes) {
+    assert(size > 0 && size <= BLOCK_SIZE);
+    uint32_t offsets[BLOCK_SIZE];
+    uint32_t counts_1[BLOCK_SIZE];
+    uint32_t max_count = 0;
+    for (int i = 0; i < size; ++i) {
+        offsets[i] = ordinals[i] - ordinals[0];
+        counts_1[i] = counts[i] - 1;
+        max_count = max(max_count, counts_1[i]);
+    }
+    BlockInfo info {
+        static_cast<int>(ordinals[0]),
+        static_cast<int>(ordinals[size - 1]),
+        static_cast<uint32_t>(bytes.size()),
+        static_cast<uint8_t>(size),
+        static_cast<uint8_t>(GetBitWidth(offsets[size - 1])),
+        static_cast<uint8_t>(GetBitWidth(max_count))
+    };
+    PackBits(offsets, size, info.offset_bits, bytes);
+    PackBits(counts_1, size, info.count_bits, bytes);
+    return info;
+}
+
+size_t PostingList::GetBlockBytes(const BlockInfo& info) {
+    return GetPackedBytes(info.size, info.offset_bits)
+         + GetPackedBytes(info.size, info.count_bits);
+}
+
+void PostingList::SealTail() {
+    uint32_t ordinals[BLOCK_SIZE];
+    uint32_t counts[BLOCK_SIZE];
+    const int size = static_cast<int>(tail_.size());
+    for (int i = 0; i < size; ++i) {
+        ordinals[i] = static_cast<uint32_t>(tail_[i].ordinal);
+        counts[i] = static_cast<uint32_t>(tail_[i].term_count);
+    }
+    DetachMapping();
+    // append the block in place of the padding
+    data_.resize(data_.empty() ? 0 : data_.size() - PADDING);
+    blocks_.push_back(EncodeBlock(ordinals, counts, size, data_));
+    data_.resize(data_.size() + PADDING, 0);
+    tail_.clear();
+}
+
+bool PostingList::IsValid(int ordinal_count) const {
+    // blocks are contiguous from the start of the data and followed by
+    // padding, as SealTail keeps them
+    size_t end = 0;
+    size_t size = tail_.size();
+    int last_ordinal = -1;
+    uint32_t ordinals[BLOCK_SIZE];
+    uint32_t counts[BLOCK_SIZE];
+    for (size_t block = 0; block < blocks_.size(); ++block) {
+        const BlockInfo& info = blocks_[block];
+        if (info.size == 0 || info.size > BLOCK_SIZE
+            || info.offset_bits > 32 || info.count_bits > 32
+            || info.offset != end
+            || info.first_ordinal <= last_ordinal
+            || info.first_ordinal > info.last_ordinal
+            || info.last_ordinal >= ordinal_count) {
+            return false;
+        }
+        end += GetBlockBytes(info);
+        if (end + PADDING > mapped_size_) {
+            return false;
+        }
+        // headers are trusted by ForEach and FindBlock, so they must match
+        // the values; a wrapped ordinal breaks the order
+        DecodeBlock(block, ordinals, counts);
+        for (int i = 0; i < info.size; ++i) {
+            if ((i == 0 ? ordinals[i] != static_cast<uint32_t>(info.first_ordinal)
+                        : ordinals[i] <= ordinals[i - 1])
+                || counts[i] == 0 || counts[i] > static_cast<uint32_t>(numeric_limits<int>::max())) {
+                return false;
+            }
+        }
+        if (ordinals[info.size - 1] != static_cast<uint32_t>(info.last_ordinal)) {
+            return false;
+        }
+        last_ordinal = info.last_ordinal;
+        size += info.size;
+    }
+    if (mapped_size_ != end + PADDING && !(blocks_.empty() && mapped_size_ == 0)) {
+        return false;
+    }
+    // a full tail is sealed by Add, SealTail can't pack a longer one
+    if (tail_.size() >= BLOCK_SIZE) {
+        return false;
+    }
+    for (const Posting& posting : tail_) {
+        if (posting.ordinal <= last_ordinal || posting.ordinal >= ordinal_count
+            || posting.term_count <= 0) {
+            return false;
+        }
+        last_ordinal = posting.ordinal;
+    }
+    return size == size_;
+}
+
+PostingList::Cursor::Cursor(const PostingList& list, size_t block)
+    : list_(&list) {
+    LoadBlock(block);
+}
+
+int PostingList::Cursor::Ordinal() const {
+    const auto& blocks = list_->blocks_;
+    return block_ < blocks.size()
+        ? list_->GetOrdinal(blocks[block_], position_)
+        : list_->tail_[position_].ordinal;
+}
+
+int PostingList::Cursor::TermCount() const {
+    const auto& blocks = list_->blocks_;
+    return block_ < blocks.size()
+        ? list_->GetTermCount(blocks[block_], position_)
+        : list_->tail_[position_].term_count;
+}
+
+void PostingList::Cursor::Seek(int ordinal) {
+    if (AtEnd()) {
+        return;
+    }
+    const auto& blocks = list_->blocks_;
+    const auto& tail = list_->tail_;
+    if (block_ < blocks.size() && blocks[block_].last_ordinal < ordinal) {
+        // skip blocks by their headers
+        LoadBlock(list_->FindBlock(block_ + 1, ordinal));
+    }
+    if (block_ == blocks.size() && !tail.empty() && tail.back().ordinal < ordinal) {
+        LoadBlock(block_ + 1);
+    }
+    if (AtEnd()) {
+        return;
+    }
+    // the block contains the ordinal or a greater one
+    if (block_ < blocks.size()) {
+        const BlockInfo& info = blocks[block_];
+        int count = size_ - position_;
+        while (count > 0) {
+            const int step = count / 2;
+            if (list_->GetOrdinal(info, position_ + step) < ordinal) {
+                position_ += step + 1;
+                count -= step + 1;
+            } else {
+                count = step;
+            }
+        }
+    } else {
+        position_ = lower_bound(tail.begin() + position_, tail.end(), ordinal,
+            [](const Posting& posting, int ord) {
+                return posting.ordinal < ord;
+            }) - tail.begin();
+    }
+}
+
+void PostingList::Cursor::LoadBlock(size_t block) {
+    block_ = block;
+    position_ = 0;
+    const auto& blocks = list_->blocks_;
+    if (block < blocks.size()) {
+        size_ = blocks[block].size;
+    } else if (block == blocks.size()) {
+        size_ = static_cast<int>(list_->tail_.size());
+    } else {
+        size_ = 0;
+    }
+}
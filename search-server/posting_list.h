@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib> // size_t
+#include <memory>
+#include <vector>
+
+class MappedFile;
+class SnapshotReader;
+class SnapshotWriter;
+
+// Posting list of a word: (document ordinal, term count) pairs sorted by
+// ordinal. Term frequency is term count divided by the document's word count,
+// so it is not stored.
+//
+// Postings are compressed in blocks of BLOCK_SIZE (frame of reference):
+// ordinals are stored as offsets from the first ordinal of the block, and both
+// offsets and counts are bit-packed with the least bit width of the block.
+// Any value of a block is read without decoding the rest, so Cursor skips
+// blocks by their headers and binary searches inside a block. New postings go
+// to an uncompressed tail, which is packed into a block when it is full.
+class PostingList {
+public:
+    static constexpr int BLOCK_SIZE = 128;
+
+    class Cursor;
+
+    // Append posting; ordinal must be greater than ordinals in the list
+    void Add(int ordinal, int term_count, double term_freq);
+
+    // Cursor at the first posting with ordinal not less than the given one
+    Cursor LowerBound(int ordinal) const;
+
+    // Call func(ordinal, term_count) for postings with ordinals from
+    // [first_ordinal, last_ordinal); faster than Cursor for long scans
+    template <typename Func>
+    void ForEach(int first_ordinal, int last_ordinal, Func func) const;
+
+    // Upper bound of term frequency in the list
+    double GetMaxTermFreq() const;
+
+    size_t size() const;
+    bool empty() const;
+
+    void Save(SnapshotWriter& writer) const;
+    // Packed blocks are not copied but read from the mapping of the reader
+    // until the list is changed. Throw std::runtime_error if the list is
+    // corrupted or has ordinals out of [0, ordinal_count)
+    static PostingList Load(SnapshotReader& reader, int ordinal_count);
+
+private:
+    struct Posting {
+        int ordinal;
+        int term_count;
+    };
+
+    struct BlockInfo {
+        int first_ordinal;
+        int last_ordinal;
+        uint32_t offset;
+        uint8_t size;
+        uint8_t offset_bits;
+        uint8_t count_bits;
+    };
+
+    std::vector<BlockInfo> blocks_;
+    // packed blocks followed by padding for 8-byte reads
+    std::vector<uint8_t> data_;
+    // packed blocks (with padding) inside a snapshot mapping used instead
+    // of data_ if the mapping is set
+    std::shared_ptr<const MappedFile> mapping_;
+    const uint8_t* mapped_data_ = nullptr;
+    size_t mapped_size_ = 0;
+    std::vector<Posting> tail_;
+    size_t size_ = 0;
+    double max_term_freq_ = 0.0;
+
+    const uint8_t* GetData() const {
+        return mapping_ ? mapped_data_ : data_.data();
+    }
+    // Copy packed blocks from the mapping before changing them
+    void DetachMapping();
+    // Decode block and return its size
+    int DecodeBlock(size_t block, uint32_t* ordinals, uint32_t* counts) const;
+    int GetOrdinal(const BlockInfo& info, int index) const;
+    int GetTermCount(const BlockInfo& info, int index) const;
+    // Index of the first block which may contain the ordinal
+    size_t FindBlock(size_t first_block, int ordinal) const;
+    // Pack postings into bytes (without padding) and return block header
+    static BlockInfo EncodeBlock(const uint32_t* ordinals, const uint32_t* counts, int size,
+                                 std::vector<uint8_t>& bytes);
+    static size_t GetBlockBytes(const BlockInfo& info);
+    void SealTail();
+    // Check the blocks and the tail of a loaded list: values are decoded, so
+    // that nothing is read out of the data or out of the documents later
+    bool IsValid(int ordinal_count) const;
+};
+
+// Forward iterator over postings; reads packed values in place
+class PostingList::Cursor {
+public:
+    // Cursor at the first posting of the block
+    Cursor(const PostingList& list, size_t block);
+
+    bool AtEnd() const {
+        return position_ == size_;
+    }
+
+    int Ordinal() const;
+    int TermCount() const;
+
+    void Next() {
+        if (++position_ == size_) {
+            LoadBlock(block_ + 1);
+        }
+    }
+
+    // Move to the first posting with ordinal not less than the given one
+    void Seek(int ordinal);
+
+private:
+    const PostingList* list_;
+    // blocks_.size() is index of the tail
+    size_t block_ = 0;
+    int size_ = 0;
+    int position_ = 0;
+
+    void LoadBlock(size_t block);
+};
+
+template <typename Func>
+void PostingList::ForEach(int first_ordinal, int last_ordinal, Func func) const {
+    uint32_t ordinals[BLOCK_SIZE];
+    uint32_t counts[BLOCK_SIZE];
+    for (size_t block = FindBlock(0, first_ordinal);
+         block < blocks_.size() && blocks_[block].first_ordinal < last_ordinal; ++block) {
+        const int size = DecodeBlock(block, ordinals, counts);
+        const BlockInfo& info = blocks_[block];
+        if (info.first_ordinal >= first_ordinal && info.last_ordinal < last_ordinal) {
+            for (int i = 0; i < size; ++i) {
+                func(static_cast<int>(ordinals[i]), static_cast<int>(counts[i]));
+            }
+            continue;
+        }
+        for (int i = 0; i < size; ++i) {
+            const int ordinal = static_cast<int>(ordinals[i]);
+            if (ordinal >= first_ordinal && ordinal < last_ordinal) {
+                func(ordinal, static_cast<int>(counts[i]));
+            }
+        }
+    }
+    for (const Posting& posting : tail_) {
+        if (posting.ordinal >= last_ordinal) {
+            break;
+        }
+        if (posting.ordinal >= first_ordinal) {
+            func(posting.ordinal, posting.term_count);
+        }
+    }
+}
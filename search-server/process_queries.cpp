@@ -1,5 +1,3 @@
-#include <algorithm>
-#include <execution>
 #include <utility>
 
 #include "process_queries.h"
@@ -11,14 +9,9 @@ ProcessQueries(
     const SearchServer& search_server,
     const vector<string>& queries) {
 
-    vector<vector<Document>> documents(queries.size());
-    transform(
-        execution::par,
-        queries.begin(), queries.end(), documents.begin(),
-        [&search_server](const string& query) {
-            return search_server.FindTopDocuments(query);} );
-    
-    return documents;
+    STAGE_LATENCY_SCOPE(timer, QueryStage::PROCESS_QUERIES);
+    // queries of the batch share term lookups and are balanced by cost
+    return search_server.FindTopDocumentsBatch(queries);
 }
 
 Iterable2D<vector<vector<Document>>>
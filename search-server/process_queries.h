@@ -1,16 +1,67 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdlib> // size_t
+#include <future>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <utility>
 
 #include "search_server.h"
+#include "stage_latency.h"
 
 std::vector<std::vector<Document>>
 ProcessQueries(
     const SearchServer& search_server,
     const std::vector<std::string>& queries);
 
+inline constexpr size_t PROCESS_QUERIES_WINDOW = 1024;
+
+// Call sink(query index, documents) for every query in the order of queries.
+// Queries are processed in windows of window queries: the next window is
+// processed while the sink takes results of the current one, so at most two
+// windows of results are kept whatever the count of queries, and the first
+// results don't wait for the last queries
+template <typename Sink>
+void ProcessQueriesStream(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    Sink sink,
+    size_t window = PROCESS_QUERIES_WINDOW);
+
+
+template <typename Sink>
+void ProcessQueriesStream(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    Sink sink,
+    size_t window) {
+
+    window = std::max<size_t>(window, 1);
+    const auto process_window = [&search_server, &queries, window](size_t first) {
+        STAGE_LATENCY_SCOPE(timer, QueryStage::PROCESS_QUERIES);
+        const size_t last = std::min(queries.size(), first + window);
+        return search_server.FindTopDocumentsBatch(
+            std::vector<std::string_view>(queries.begin() + first, queries.begin() + last));
+    };
+    if (queries.empty()) {
+        return;
+    }
+    std::future<std::vector<std::vector<Document>>> next = std::async(std::launch::async, process_window, 0);
+    for (size_t first = 0; first < queries.size(); first += window) {
+        // an error of a query is thrown here, after results of the queries
+        // before its window
+        std::vector<std::vector<Document>> documents = next.get();
+        if (first + window < queries.size()) {
+            next = std::async(std::launch::async, process_window, first + window);
+        }
+        for (size_t i = 0; i < documents.size(); ++i) {
+            sink(first + i, std::move(documents[i]));
+        }
+    }
+}
+
 
 template <typename OuterContainer>
 class Iterable2D {
@@ -37,7 +88,9 @@ private:
             inner_iterator_type inner_iterator) :
                 iterable2d_(iterable),
                 outer_iterator_(outer_iterator),
-                inner_iterator_(inner_iterator) { }
+                inner_iterator_(inner_iterator) {
+            SkipEmpty();
+        }
 
     public:
         using iterator_category = std::forward_iterator_tag;
@@ -70,10 +123,7 @@ private:
 
         BasicIterator& operator++() noexcept {
             ++inner_iterator_;
-            if (inner_iterator_ == outer_iterator_->end()) {
-                ++outer_iterator_;
-                inner_iterator_ = outer_iterator_->begin();
-            }
+            SkipEmpty();
             return *this;
         }
 
@@ -96,6 +146,17 @@ private:
         Iterable2D& iterable2d_;
         outer_iterator_type outer_iterator_;
         inner_iterator_type inner_iterator_;
+
+        // move to the next element if inner containers are over (some
+        // queries may have no documents)
+        void SkipEmpty() noexcept {
+            while (outer_iterator_ != iterable2d_.outer_.end() && inner_iterator_ == outer_iterator_->end()) {
+                ++outer_iterator_;
+                if (outer_iterator_ != iterable2d_.outer_.end()) {
+                    inner_iterator_ = outer_iterator_->begin();
+                }
+            }
+        }
     };
 
 public:
@@ -117,6 +178,9 @@ public:
 
     [[nodiscard]]
     Iterator begin() noexcept {
+        if (outer_.empty()) {
+            return end();
+        }
         return Iterator{*this, outer_.begin(), outer_.front().begin()};
     }
 
@@ -0,0 +1,55 @@
+#include "query_cache.h"
+
+#include <functional>
+#include <utility>
+
+using namespace std;
+
+QueryCache::QueryCache(size_t capacity)
+    : capacity_(capacity)
+    , shard_capacity_((capacity + SHARD_COUNT - 1) / SHARD_COUNT) {
+}
+
+bool QueryCache::Find(const string& key, uint64_t generation, vector<Document>& documents) {
+    Shard& shard = GetShard(key);
+    lock_guard guard(shard.mutex);
+    const auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        return false;
+    }
+    const auto entry = it->second;
+    if (entry->generation != generation) {
+        shard.index.erase(it);
+        shard.entries.erase(entry);
+        return false;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+    documents = entry->documents;
+    return true;
+}
+
+void QueryCache::Insert(string key, uint64_t generation, vector<Document> documents) {
+    if (shard_capacity_ == 0) {
+        return;
+    }
+    Shard& shard = GetShard(key);
+    lock_guard guard(shard.mutex);
+    const auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        // another thread has computed the same query
+        it->second->generation = generation;
+        it->second->documents = move(documents);
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        return;
+    }
+    if (shard.entries.size() == shard_capacity_) {
+        shard.index.erase(shard.entries.back().key);
+        shard.entries.pop_back();
+    }
+    shard.entries.push_front({move(key), generation, move(documents)});
+    shard.index.emplace(shard.entries.front().key, shard.entries.begin());
+}
+
+QueryCache::Shard& QueryCache::GetShard(string_view key) {
+    return shards_[hash<string_view>{}(key) % SHARD_COUNT];
+}
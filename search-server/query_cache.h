@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib> // size_t
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "document.h"
+
+// Bounded LRU cache of query results. Keys are spread over shards with their
+// own locks, so concurrent queries rarely wait for each other. Every entry
+// keeps the index generation it was computed for; an entry of another
+// generation is a miss and is dropped.
+class QueryCache {
+public:
+    explicit QueryCache(size_t capacity);
+
+    // Copy cached documents to documents; return false on a miss
+    bool Find(const std::string& key, uint64_t generation, std::vector<Document>& documents);
+
+    void Insert(std::string key, uint64_t generation, std::vector<Document> documents);
+
+    size_t GetCapacity() const {
+        return capacity_;
+    }
+
+private:
+    static constexpr size_t SHARD_COUNT = 16;
+
+    struct Entry {
+        std::string key;
+        uint64_t generation;
+        std::vector<Document> documents;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        // the most recently used entry is the first one
+        std::list<Entry> entries;
+        // keys are views of Entry::key
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+    };
+
+    size_t capacity_;
+    size_t shard_capacity_;
+    Shard shards_[SHARD_COUNT];
+
+    Shard& GetShard(std::string_view key);
+};
@@ -1,6 +1,15 @@
 #pragma once
 
+#include <vector>
+
 #include "search_server.h"
 
-void RemoveDuplicates(SearchServer& search_server);
+// Remove documents with the same set of words as a document with a lesser
+// id; return ids of the removed documents in ascending order
+std::vector<int> RemoveDuplicates(SearchServer& search_server);
 
+// Remove documents whose Jaccard similarity of sets of words with a kept
+// document with a lesser id is at least min_similarity (see
+// SearchIndex::FindNearDuplicateDocuments); return ids of the removed
+// documents in ascending order
+std::vector<int> RemoveNearDuplicates(SearchServer& search_server, double min_similarity);
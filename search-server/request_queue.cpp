@@ -1,38 +1,67 @@
 #include "request_queue.h"
 
+#include <algorithm>
+#include <utility>
+
 using namespace std;
 
 RequestQueue::RequestQueue(const SearchServer& search_server)
-    : search_server_(search_server) {
+    : search_server_(search_server)
+    , ticks_(min_in_day_) {
+    // sizes from 0 to MAX_RESULT_DOCUMENT_COUNT and greater ones
+    totals_.result_counts.assign(MAX_RESULT_DOCUMENT_COUNT + 2, 0);
 }
 
 vector<Document>
 RequestQueue::AddFindRequest(const string& raw_query, DocumentStatus status) {
-    return AddQueryResult(search_server_.FindTopDocuments(raw_query, status));
+    const auto start = chrono::steady_clock::now();
+    vector<Document> documents = search_server_.FindTopDocuments(raw_query, status);
+    return AddQueryResult(move(documents), chrono::steady_clock::now() - start);
 }
 
 vector<Document>
 RequestQueue::AddFindRequest(const string& raw_query) {
-    return AddQueryResult(search_server_.FindTopDocuments(raw_query));
+    const auto start = chrono::steady_clock::now();
+    vector<Document> documents = search_server_.FindTopDocuments(raw_query);
+    return AddQueryResult(move(documents), chrono::steady_clock::now() - start);
 }
 
 int RequestQueue::GetNoResultRequests() const {
-    return no_result_requests_;
+    lock_guard guard(mutex_);
+    return totals_.no_result_request_count;
 }
 
-vector<Document>
-RequestQueue::AddQueryResult(const vector<Document> documents) {
-    ++current_time_;
+RequestQueue::Statistics RequestQueue::GetStatistics() const {
+    lock_guard guard(mutex_);
+    return totals_;
+}
 
-    while (!requests_.empty() && min_in_day_ <= current_time_ - requests_.front().timestamp) {
-        if (requests_.front().results == 0) {
-            --no_result_requests_;
+vector<Document>
+RequestQueue::AddQueryResult(vector<Document> documents, chrono::nanoseconds latency) {
+    const Tick tick{documents.size(), latency};
+    lock_guard guard(mutex_);
+    Tick& slot = ticks_[current_time_ % min_in_day_];
+    // the tick of the slot leaves the window
+    if (current_time_ >= static_cast<uint64_t>(min_in_day_)) {
+        --totals_.request_count;
+        if (slot.result_count == 0) {
+            --totals_.no_result_request_count;
         }
-        requests_.pop_front();
+        --totals_.result_counts[GetResultBucket(slot.result_count)];
+        totals_.latencies.Remove(slot.latency);
     }
-    requests_.push_back(QueryResult{current_time_, documents.size()});
-    if (documents.size() == 0)
-        ++no_result_requests_;
+    slot = tick;
+    ++current_time_;
+    ++totals_.request_count;
+    if (tick.result_count == 0) {
+        ++totals_.no_result_request_count;
+    }
+    ++totals_.result_counts[GetResultBucket(tick.result_count)];
+    totals_.latencies.Record(tick.latency);
 
     return documents;
-}
\ No newline at end of file
+}
+
+size_t RequestQueue::GetResultBucket(size_t result_count) const {
+    return min(result_count, totals_.result_counts.size() - 1);
+}
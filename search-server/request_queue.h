@@ -1,15 +1,30 @@
 #pragma once
 
+#include <chrono>
 #include <cstdlib>
-#include <deque>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "document.h"
+#include "latency_histogram.h"
 #include "search_server.h"
 
+// Statistics of the last min_in_day_ requests, every request is a tick of
+// the window. Ticks are kept in a ring of fixed size and totals of the window
+// are updated when a tick leaves it, so memory doesn't grow with requests.
+// Requests may be added from several threads
 class RequestQueue {
 public:
+    struct Statistics {
+        int request_count = 0;
+        int no_result_request_count = 0;
+        // result_counts[i] is the count of requests with i documents; the
+        // last bucket counts requests with at least that many documents
+        std::vector<int> result_counts;
+        LatencyHistogram latencies;
+    };
+
     explicit RequestQueue(const SearchServer& search_server);
 
     template <typename DocumentPredicate>
@@ -19,25 +34,35 @@ public:
 
     std::vector<Document> AddFindRequest(const std::string& raw_query);
 
+    // Count a request made elsewhere (e.g. by ProcessQueries); documents are
+    // taken by move and given back
+    std::vector<Document> AddQueryResult(std::vector<Document> documents, std::chrono::nanoseconds latency);
+
     int GetNoResultRequests() const;
 
+    Statistics GetStatistics() const;
+
 private:
-    struct QueryResult {
-        int timestamp;
-        size_t results;
+    struct Tick {
+        size_t result_count;
+        std::chrono::nanoseconds latency;
     };
-    
-    std::deque<QueryResult> requests_;
+
     const static int min_in_day_ = 1440;
     const SearchServer& search_server_;
-    int no_result_requests_ = 0;
-    int current_time_;
+    mutable std::mutex mutex_;
+    // ring of the ticks of the window
+    std::vector<Tick> ticks_;
+    uint64_t current_time_ = 0;
+    Statistics totals_;
 
-    std::vector<Document> AddQueryResult(const std::vector<Document> documents);
+    size_t GetResultBucket(size_t result_count) const;
 };
 
 template <typename DocumentPredicate>
 std::vector<Document>
 RequestQueue::AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate) {
-    return AddQueryResult(raw_query, search_server_.FindTopDocuments(raw_query, document_predicate));
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<Document> documents = search_server_.FindTopDocuments(raw_query, document_predicate);
+    return AddQueryResult(std::move(documents), std::chrono::steady_clock::now() - start);
 }
@@ -0,0 +1,1324 @@
+#include "search_index.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <exception>
+#include <execution>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "document.h"
+#include "snapshot.h"
+#include "string_processing.h"
+
+using namespace std;
+
+namespace {
+
+const char SNAPSHOT_MAGIC[8] = {'S', 'R', 'C', 'H', 'S', 'N', 'A', 'P'};
+const uint32_t SNAPSHOT_VERSION = 3;
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+// compaction starts when postings of removed documents are at least
+// 1 / COMPACTION_RATIO of all postings
+const size_t COMPACTION_RATIO = 4;
+const size_t MIN_COMPACTION_POSTINGS = 4096;
+
+// words of a query matched by one parallel task; queries with fewer words
+// are matched sequentially
+const size_t MIN_MATCH_TASK_WORDS = 32;
+
+// MinHash signatures are split into LSH_BANDS bands of LSH_ROWS hashes;
+// documents with an equal band are candidates to be near duplicates. The
+// probability for a pair with similarity s to be a candidate is
+// 1 - (1 - s^LSH_ROWS)^LSH_BANDS: 0.89 for s = 0.6, 0.9998 for s = 0.8
+const int LSH_BANDS = 16;
+const int LSH_ROWS = 4;
+
+// finalizer of splitmix64
+uint64_t MixHash(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111eb;
+    value ^= value >> 31;
+    return value;
+}
+
+struct Fingerprint {
+    uint64_t high;
+    uint64_t low;
+
+    bool operator<(const Fingerprint& other) const {
+        return high < other.high || (high == other.high && low < other.low);
+    }
+
+    bool operator==(const Fingerprint& other) const {
+        return high == other.high && low == other.low;
+    }
+};
+
+// two independent 64-bit hashes of the sequence of values
+template <typename Value>
+Fingerprint ComputeFingerprint(const Value* first, const Value* last) {
+    Fingerprint fingerprint{MixHash(last - first), MixHash((last - first) ^ 0x9e3779b97f4a7c15)};
+    for (; first != last; ++first) {
+        fingerprint.high = MixHash(fingerprint.high + *first);
+        fingerprint.low = MixHash(fingerprint.low ^ (uint64_t{*first} * 0xc2b2ae3d27d4eb4f));
+    }
+    return fingerprint;
+}
+
+// |A & B| / |A | B| of sorted sets; two empty sets are equal
+template <typename Value>
+double ComputeJaccardSimilarity(const Value* first1, const Value* last1,
+                                const Value* first2, const Value* last2) {
+    const size_t size1 = last1 - first1;
+    const size_t size2 = last2 - first2;
+    if (size1 == 0 && size2 == 0) {
+        return 1.0;
+    }
+    size_t common = 0;
+    while (first1 != last1 && first2 != last2) {
+        if (*first1 < *first2) {
+            ++first1;
+        } else if (*first2 < *first1) {
+            ++first2;
+        } else {
+            ++common;
+            ++first1;
+            ++first2;
+        }
+    }
+    return static_cast<double>(common) / static_cast<double>(size1 + size2 - common);
+}
+
+// Call action for the values of both sorted ranges while it returns true.
+// Values of the longer range are skipped by galloping, so a short query
+// costs O(query size * log(document size / query size))
+template <typename Value, typename Action>
+void IntersectSorted(const Value* first1, const Value* last1,
+                     const Value* first2, const Value* last2, Action action) {
+    if (last1 - first1 > last2 - first2) {
+        swap(first1, first2);
+        swap(last1, last2);
+    }
+    for (; first1 != last1 && first2 != last2; ++first1) {
+        const Value value = *first1;
+        // find a bound of the value doubling the step, then search below it
+        ptrdiff_t step = 1;
+        while (step < last2 - first2 && first2[step] < value) {
+            step *= 2;
+        }
+        first2 = lower_bound(first2 + step / 2, first2 + min(step + 1, last2 - first2), value);
+        if (first2 != last2 && *first2 == value) {
+            if (!action(value)) {
+                return;
+            }
+            ++first2;
+        }
+    }
+}
+
+} // namespace
+
+SearchIndex::SearchIndex(const string& stop_words)
+    : SearchIndex(string_view(stop_words)) {
+}
+
+SearchIndex::SearchIndex(const string_view stop_words)
+    : SearchIndex(SplitIntoWordsView(stop_words)) {
+}
+
+void SearchIndex::AddDocument(int document_id, const string_view document, DocumentStatus status, const vector<int>& ratings) {
+    AddDocumentBatch(execution::seq, {{document_id, document, status, ComputeAverageRating(ratings)}});
+}
+
+template <typename ExecutionPolicy>
+void
+SearchIndex::AddDocumentBatch(ExecutionPolicy policy, const vector<DocumentToAdd>& documents) {
+    vector<int> ids;
+    ids.reserve(documents.size());
+    for (const DocumentToAdd& document : documents) {
+        if (document.id < 0) {
+            throw invalid_argument("Document's id is out of range"s);
+        }
+        if (document_ordinals_.count(document.id) > 0) {
+            throw invalid_argument("Document's id alredy exists"s);
+        }
+        ids.push_back(document.id);
+    }
+    sort(ids.begin(), ids.end());
+    if (adjacent_find(ids.begin(), ids.end()) != ids.end()) {
+        throw invalid_argument("Document's id alredy exists"s);
+    }
+
+    // tokenize documents; exceptions can't leave parallel algorithms
+    vector<DocumentWords> document_words(documents.size());
+    transform(policy, documents.begin(), documents.end(), document_words.begin(),
+        [this](const DocumentToAdd& document) {
+            return CountDocumentWords(document.text);
+        });
+    for (const DocumentWords& words : document_words) {
+        if (!words.valid) {
+            throw invalid_argument("Invalid character"s);
+        }
+    }
+
+    // postings of the batch; known terms are found in parallel, new ones
+    // are interned serially
+    struct TermPosting {
+        string_view word;
+        TermId term;
+        int document;
+        int count;
+    };
+    vector<TermPosting> postings;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        for (const auto& [word, count] : document_words[i].word_counts) {
+            postings.push_back({word, TermDictionary::NO_TERM, static_cast<int>(i), count});
+        }
+    }
+    for_each(policy, postings.begin(), postings.end(), [this](TermPosting& posting) {
+        posting.term = terms_.Find(posting.word);
+    });
+    for (TermPosting& posting : postings) {
+        if (posting.term == TermDictionary::NO_TERM) {
+            posting.term = terms_.Insert(posting.word);
+        }
+    }
+    term_postings_.resize(terms_.size());
+    term_document_freqs_.resize(terms_.size());
+    term_log_document_freqs_.resize(terms_.size());
+    sort(policy, postings.begin(), postings.end(), [](const TermPosting& lhs, const TermPosting& rhs) {
+        return lhs.term < rhs.term || (lhs.term == rhs.term && lhs.document < rhs.document);
+    });
+
+    // posting lists of different terms are independent and filled in parallel
+    struct TermGroup {
+        size_t first;
+        size_t last;
+    };
+    vector<TermGroup> groups;
+    for (size_t first = 0; first < postings.size();) {
+        size_t last = first + 1;
+        while (last < postings.size() && postings[last].term == postings[first].term) {
+            ++last;
+        }
+        groups.push_back({first, last});
+        first = last;
+    }
+
+    const int first_ordinal = static_cast<int>(ordinal_document_ids_.size());
+    vector<double> inv_word_counts(documents.size());
+    for (size_t i = 0; i < documents.size(); ++i) {
+        const int word_count = document_words[i].word_count;
+        inv_word_counts[i] = word_count == 0 ? 0.0 : 1.0 / word_count;
+    }
+    for_each(policy, groups.begin(), groups.end(),
+        [this, &postings, &inv_word_counts, first_ordinal](const TermGroup& group) {
+            const TermId term = postings[group.first].term;
+            PostingList& term_postings = term_postings_[term];
+            for (size_t i = group.first; i < group.last; ++i) {
+                const TermPosting& posting = postings[i];
+                term_postings.Add(first_ordinal + posting.document, posting.count,
+                                  posting.count * inv_word_counts[posting.document]);
+            }
+            term_document_freqs_[term] += static_cast<uint32_t>(group.last - group.first);
+            UpdateTermWeight(term);
+        });
+
+    // forward index: postings are sorted by term, so terms of every
+    // document are placed in sorted order
+    vector<size_t> positions(documents.size());
+    for (size_t i = 0; i < documents.size(); ++i) {
+        positions[i] = ordinal_term_offsets_.back();
+        ordinal_term_offsets_.push_back(positions[i] + document_words[i].word_counts.size());
+    }
+    ordinal_terms_.resize(ordinal_term_offsets_.back());
+    for (const TermPosting& posting : postings) {
+        ordinal_terms_[positions[posting.document]++] = posting.term;
+    }
+    posting_count_ += postings.size();
+    ordinal_tombstones_.resize((first_ordinal + documents.size() + 63) / 64);
+
+    for (size_t i = 0; i < documents.size(); ++i) {
+        const DocumentToAdd& document = documents[i];
+        document_ordinals_.emplace(document.id, first_ordinal + static_cast<int>(i));
+        ordinal_document_ids_.push_back(document.id);
+        ordinal_ratings_.push_back(document.rating);
+        ordinal_statuses_.push_back(document.status);
+        ordinal_inv_word_counts_.push_back(inv_word_counts[i]);
+        document_ids_.insert(document.id);
+    }
+    UpdateDocumentCountWeight();
+    ++generation_;
+}
+
+template void SearchIndex::AddDocumentBatch(execution::sequenced_policy, const vector<DocumentToAdd>&);
+template void SearchIndex::AddDocumentBatch(execution::parallel_policy, const vector<DocumentToAdd>&);
+
+void
+SearchIndex::RemoveDocument(int document_id) {
+    const auto ordinal_it = document_ordinals_.find(document_id);
+    if (ordinal_it == document_ordinals_.end())
+        return;
+    const int ordinal = ordinal_it->second;
+    // postings stay in the lists, only the weights of the terms change;
+    // terms are kept in the dictionary even if they are in no document
+    ordinal_tombstones_[ordinal / 64] |= uint64_t{1} << (ordinal % 64);
+    for (size_t i = ordinal_term_offsets_[ordinal]; i < ordinal_term_offsets_[ordinal + 1]; ++i) {
+        const TermId term = ordinal_terms_[i];
+        --term_document_freqs_[term];
+        UpdateTermWeight(term);
+    }
+    removed_posting_count_ += ordinal_term_offsets_[ordinal + 1] - ordinal_term_offsets_[ordinal];
+    document_ordinals_.erase(ordinal_it);
+    document_ids_.erase(document_id);
+    UpdateDocumentCountWeight();
+    ++generation_;
+}
+
+template <>
+void
+SearchIndex::RemoveDocument(std::execution::sequenced_policy, int document_id) {
+    RemoveDocument(document_id);
+}
+
+template <>
+void
+SearchIndex::RemoveDocument(std::execution::parallel_policy, int document_id) {
+    const auto ordinal_it = document_ordinals_.find(document_id);
+    if (ordinal_it == document_ordinals_.end())
+        return;
+    const int ordinal = ordinal_it->second;
+    ordinal_tombstones_[ordinal / 64] |= uint64_t{1} << (ordinal % 64);
+
+    // terms of the document
+    const auto terms_begin = ordinal_terms_.begin() + ordinal_term_offsets_[ordinal];
+    const auto terms_end = ordinal_terms_.begin() + ordinal_term_offsets_[ordinal + 1];
+
+    // parallel
+    for_each(
+        execution::par,
+        terms_begin,
+        terms_end,
+        [this](TermId term) {
+            // can change bacause each thread for unique term
+            --term_document_freqs_[term];
+            UpdateTermWeight(term);
+        } );
+
+    removed_posting_count_ += terms_end - terms_begin;
+    document_ordinals_.erase(ordinal_it);
+    document_ids_.erase(document_id);
+    UpdateDocumentCountWeight();
+    ++generation_;
+}
+
+void SearchIndex::RemoveDocuments(const vector<int>& document_ids) {
+    RemoveDocuments(execution::seq, document_ids);
+}
+
+template <typename ExecutionPolicy>
+void SearchIndex::RemoveDocuments(ExecutionPolicy policy, const vector<int>& document_ids) {
+    vector<int> ordinals;
+    ordinals.reserve(document_ids.size());
+    size_t removed_posting_count = 0;
+    for (const int document_id : document_ids) {
+        const auto ordinal_it = document_ordinals_.find(document_id);
+        if (ordinal_it == document_ordinals_.end())
+            continue;
+        const int ordinal = ordinal_it->second;
+        ordinal_tombstones_[ordinal / 64] |= uint64_t{1} << (ordinal % 64);
+        removed_posting_count += ordinal_term_offsets_[ordinal + 1] - ordinal_term_offsets_[ordinal];
+        ordinals.push_back(ordinal);
+        document_ordinals_.erase(ordinal_it);
+        document_ids_.erase(document_id);
+    }
+    if (ordinals.empty()) {
+        return;
+    }
+
+    // terms of all the documents are sorted, so a run of equal terms gives
+    // the count of removed documents with the term
+    vector<TermId> terms;
+    terms.reserve(removed_posting_count);
+    for (const int ordinal : ordinals) {
+        terms.insert(terms.end(), ordinal_terms_.begin() + ordinal_term_offsets_[ordinal],
+                     ordinal_terms_.begin() + ordinal_term_offsets_[ordinal + 1]);
+    }
+    sort(policy, terms.begin(), terms.end());
+    struct TermGroup {
+        size_t first;
+        size_t last;
+    };
+    vector<TermGroup> groups;
+    for (size_t first = 0; first < terms.size();) {
+        size_t last = first + 1;
+        while (last < terms.size() && terms[last] == terms[first]) {
+            ++last;
+        }
+        groups.push_back({first, last});
+        first = last;
+    }
+    // every group has its own term
+    for_each(policy, groups.begin(), groups.end(), [this, &terms](const TermGroup& group) {
+        const TermId term = terms[group.first];
+        term_document_freqs_[term] -= static_cast<uint32_t>(group.last - group.first);
+        UpdateTermWeight(term);
+    });
+
+    removed_posting_count_ += removed_posting_count;
+    UpdateDocumentCountWeight();
+    ++generation_;
+}
+
+template void SearchIndex::RemoveDocuments(execution::sequenced_policy, const vector<int>&);
+template void SearchIndex::RemoveDocuments(execution::parallel_policy, const vector<int>&);
+
+bool SearchIndex::NeedsCompaction() const {
+    return removed_posting_count_ >= MIN_COMPACTION_POSTINGS
+        && removed_posting_count_ * COMPACTION_RATIO >= posting_count_;
+}
+
+void SearchIndex::Compact() {
+    if (removed_posting_count_ == 0) {
+        return;
+    }
+    vector<TermId> terms;
+    for (TermId term = 0; term < term_postings_.size(); ++term) {
+        if (term_postings_[term].size() != term_document_freqs_[term]) {
+            terms.push_back(term);
+        }
+    }
+    const int ordinal_count = static_cast<int>(ordinal_document_ids_.size());
+    for_each(execution::par, terms.begin(), terms.end(), [this, ordinal_count](TermId term) {
+        PostingList compacted;
+        if (term_document_freqs_[term] == 0) {
+            // the term is in no document anymore
+            term_postings_[term] = move(compacted);
+            return;
+        }
+        term_postings_[term].ForEach(0, ordinal_count, [this, &compacted](int ordinal, int term_count) {
+            if (!IsRemoved(ordinal)) {
+                compacted.Add(ordinal, term_count, term_count * ordinal_inv_word_counts_[ordinal]);
+            }
+        });
+        term_postings_[term] = move(compacted);
+    });
+    posting_count_ -= removed_posting_count_;
+    removed_posting_count_ = 0;
+}
+
+void
+SearchIndex::SaveSnapshot(const string& path) const {
+    SnapshotWriter writer(path);
+    writer.Write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    writer.Write(SNAPSHOT_VERSION);
+    writer.Write(SNAPSHOT_BYTE_ORDER);
+
+    // terms are written in the order of ids, so ids are kept
+    writer.Write(static_cast<uint64_t>(stop_words_.size()));
+    for (TermId term = 0; term < stop_words_.size(); ++term) {
+        writer.WriteString(stop_words_.GetTerm(term));
+    }
+    writer.Write(static_cast<uint64_t>(terms_.size()));
+    for (TermId term = 0; term < terms_.size(); ++term) {
+        writer.WriteString(terms_.GetTerm(term));
+    }
+
+    writer.WriteVector(ordinal_document_ids_);
+    writer.WriteVector(ordinal_ratings_);
+    writer.WriteVector(ordinal_statuses_);
+    writer.WriteVector(ordinal_inv_word_counts_);
+    writer.WriteVector(GetOrdinalsById());
+
+    for (const PostingList& postings : term_postings_) {
+        postings.Save(writer);
+    }
+    writer.Close();
+}
+
+SearchIndex
+SearchIndex::LoadSnapshot(const string& path) {
+    SnapshotReader reader(make_shared<const MappedFile>(path));
+    const uint8_t* magic = reader.ReadBytes(sizeof(SNAPSHOT_MAGIC));
+    if (!equal(magic, magic + sizeof(SNAPSHOT_MAGIC), SNAPSHOT_MAGIC)) {
+        throw runtime_error("Not a search server snapshot: "s + path);
+    }
+    // the version is read in a foreign byte order too, so the mark goes first
+    const uint32_t version = reader.Read<uint32_t>();
+    if (reader.Read<uint32_t>() != SNAPSHOT_BYTE_ORDER) {
+        throw runtime_error("Snapshot has a different byte order: "s + path);
+    }
+    if (version != SNAPSHOT_VERSION) {
+        throw runtime_error("Unsupported snapshot version: "s + path);
+    }
+
+    SearchIndex index;
+    const uint64_t stop_word_count = reader.Read<uint64_t>();
+    for (uint64_t i = 0; i < stop_word_count; ++i) {
+        index.stop_words_.Insert(reader.ReadString());
+    }
+    const uint64_t term_count = reader.Read<uint64_t>();
+    for (uint64_t i = 0; i < term_count; ++i) {
+        if (index.terms_.Insert(reader.ReadString()) != i) {
+            throw runtime_error("Corrupted snapshot: "s + path);
+        }
+    }
+
+    index.ordinal_document_ids_ = reader.ReadVector<int>();
+    index.ordinal_ratings_ = reader.ReadVector<int>();
+    index.ordinal_statuses_ = reader.ReadVector<DocumentStatus>();
+    index.ordinal_inv_word_counts_ = reader.ReadVector<double>();
+    const size_t ordinal_count = index.ordinal_document_ids_.size();
+    if (ordinal_count > static_cast<size_t>(numeric_limits<int>::max())
+        || index.ordinal_ratings_.size() != ordinal_count
+        || index.ordinal_statuses_.size() != ordinal_count
+        || index.ordinal_inv_word_counts_.size() != ordinal_count) {
+        throw runtime_error("Corrupted snapshot: "s + path);
+    }
+    for (const int ordinal : reader.ReadVector<int>()) {
+        if (ordinal < 0 || static_cast<size_t>(ordinal) >= ordinal_count) {
+            throw runtime_error("Corrupted snapshot: "s + path);
+        }
+        const int document_id = index.ordinal_document_ids_[ordinal];
+        index.document_ordinals_.emplace_hint(index.document_ordinals_.end(), document_id, ordinal);
+        index.document_ids_.emplace_hint(index.document_ids_.end(), document_id);
+    }
+
+    index.term_postings_.reserve(term_count);
+    for (uint64_t i = 0; i < term_count; ++i) {
+        index.term_postings_.push_back(PostingList::Load(reader, static_cast<int>(ordinal_count)));
+    }
+    if (!reader.AtEnd()) {
+        throw runtime_error("Corrupted snapshot: "s + path);
+    }
+
+    // forward index is restored from the posting lists: count terms of
+    // every document, then place them; terms come in sorted order
+    const int last_ordinal = static_cast<int>(ordinal_count);
+    vector<size_t>& offsets = index.ordinal_term_offsets_;
+    offsets.assign(ordinal_count + 1, 0);
+    for (const PostingList& postings : index.term_postings_) {
+        postings.ForEach(0, last_ordinal, [&offsets](int ordinal, int) {
+            ++offsets[ordinal + 1];
+        });
+    }
+    partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    index.ordinal_terms_.resize(offsets.back());
+    vector<size_t> positions(offsets.begin(), offsets.end() - 1);
+    for (TermId term = 0; term < index.term_postings_.size(); ++term) {
+        index.term_postings_[term].ForEach(0, last_ordinal, [&index, &positions, term](int ordinal, int) {
+            index.ordinal_terms_[positions[ordinal]++] = term;
+        });
+    }
+
+    // documents which are not live are removed
+    index.ordinal_tombstones_.assign((ordinal_count + 63) / 64, 0);
+    for (size_t ordinal = 0; ordinal < ordinal_count; ++ordinal) {
+        index.ordinal_tombstones_[ordinal / 64] |= uint64_t{1} << (ordinal % 64);
+    }
+    for (const auto& [document_id, ordinal] : index.document_ordinals_) {
+        index.ordinal_tombstones_[ordinal / 64] &= ~(uint64_t{1} << (ordinal % 64));
+    }
+    index.term_document_freqs_.assign(term_count, 0);
+    index.term_log_document_freqs_.resize(term_count);
+    index.posting_count_ = index.ordinal_terms_.size();
+    for (size_t ordinal = 0; ordinal < ordinal_count; ++ordinal) {
+        if (!index.IsRemoved(static_cast<int>(ordinal))) {
+            for (size_t i = offsets[ordinal]; i < offsets[ordinal + 1]; ++i) {
+                ++index.term_document_freqs_[index.ordinal_terms_[i]];
+            }
+        } else {
+            index.removed_posting_count_ += offsets[ordinal + 1] - offsets[ordinal];
+        }
+    }
+    for (TermId term = 0; term < term_count; ++term) {
+        index.UpdateTermWeight(term);
+    }
+    index.UpdateDocumentCountWeight();
+    return index;
+}
+
+vector<Document>
+SearchIndex::FindTopDocuments(const string_view raw_query) const
+{
+    return FindTopDocuments(execution::seq, raw_query);
+}
+
+vector<Document>
+SearchIndex::FindTopDocuments(const string_view raw_query, DocumentStatus status) const
+{
+    return FindTopDocuments(execution::seq, raw_query, status);
+}
+
+vector<Document>
+SearchIndex::FindTopDocuments(const string_view raw_query, DocumentStatus status,
+                               size_t offset, size_t limit) const
+{
+    return FindTopDocuments(execution::seq, raw_query, status, offset, limit);
+}
+
+vector<vector<Document>>
+SearchIndex::FindTopDocumentsBatch(const vector<string>& raw_queries) const {
+    return FindTopDocumentsBatch(vector<string_view>(raw_queries.begin(), raw_queries.end()));
+}
+
+vector<vector<Document>>
+SearchIndex::FindTopDocumentsBatch(const vector<string_view>& raw_queries) const {
+    const size_t query_count = raw_queries.size();
+    vector<vector<Document>> documents(query_count);
+    vector<Query> queries(query_count);
+    vector<string> keys(query_cache_ ? query_count : 0);
+    // queries answered by the cache are not scored
+    vector<char> cached(query_count, false);
+    vector<exception_ptr> errors(query_count);
+    vector<size_t> indexes(query_count);
+    iota(indexes.begin(), indexes.end(), 0);
+    for_each(execution::par, indexes.begin(), indexes.end(), [&](size_t i) {
+        try {
+            ParseQuery(raw_queries[i], queries[i]);
+        } catch (...) {
+            errors[i] = current_exception();
+            return;
+        }
+        if (query_cache_) {
+            keys[i] = GetQueryCacheKey(queries[i], DocumentStatus::ACTUAL, 0, MAX_RESULT_DOCUMENT_COUNT);
+            cached[i] = query_cache_->Find(keys[i], generation_, documents[i]);
+        }
+    });
+    for (const exception_ptr& error : errors) {
+        if (error) {
+            rethrow_exception(error);
+        }
+    }
+
+    // words of all queries are grouped, so every distinct word is looked up
+    // once; groups go in the order of words, so terms of every query are
+    // in the same order as ResolveQuery gives
+    struct WordUse {
+        string_view word;
+        uint32_t query;
+        bool is_minus;
+    };
+    vector<WordUse> uses;
+    for (size_t i = 0; i < query_count; ++i) {
+        if (cached[i]) {
+            continue;
+        }
+        for (const string_view word : queries[i].plus_words) {
+            uses.push_back({word, static_cast<uint32_t>(i), false});
+        }
+        for (const string_view word : queries[i].minus_words) {
+            uses.push_back({word, static_cast<uint32_t>(i), true});
+        }
+    }
+    sort(execution::par, uses.begin(), uses.end(), [](const WordUse& lhs, const WordUse& rhs) {
+        return lhs.word < rhs.word || (lhs.word == rhs.word && lhs.query < rhs.query);
+    });
+    {
+        STAGE_LATENCY_SCOPE(timer, QueryStage::POSTING_FETCH);
+        for (size_t first = 0; first < uses.size();) {
+            size_t last = first + 1;
+            while (last < uses.size() && uses[last].word == uses[first].word) {
+                ++last;
+            }
+            const TermId term = FindIndexedTerm(uses[first].word);
+            if (term != TermDictionary::NO_TERM) {
+                const QueryTerm plus_term = GetQueryTerm(term);
+                for (size_t i = first; i < last; ++i) {
+                    Query& query = queries[uses[i].query];
+                    if (uses[i].is_minus) {
+                        query.minus_postings.push_back(plus_term.postings);
+                    } else {
+                        query.plus_terms.push_back(plus_term);
+                    }
+                }
+            }
+            first = last;
+        }
+    }
+
+    // Queries are scheduled from the most expensive one, the cost is the
+    // count of postings to scan; cheap queries are coalesced into tasks of
+    // MIN_BATCH_TASK_POSTINGS, so tasks are large enough to be worth
+    // stealing and the longest ones don't start last
+    vector<size_t> costs(query_count, 0);
+    vector<uint32_t> order;
+    for (size_t i = 0; i < query_count; ++i) {
+        if (cached[i]) {
+            continue;
+        }
+        costs[i] = 1;
+        for (const PostingList* postings : queries[i].minus_postings) {
+            costs[i] += postings->size();
+        }
+        for (const QueryTerm& term : queries[i].plus_terms) {
+            costs[i] += term.postings->size();
+        }
+        order.push_back(static_cast<uint32_t>(i));
+    }
+    sort(order.begin(), order.end(), [&costs](uint32_t lhs, uint32_t rhs) {
+        return costs[lhs] > costs[rhs];
+    });
+    struct Task {
+        size_t first;
+        size_t last;
+    };
+    vector<Task> tasks;
+    for (size_t first = 0; first < order.size();) {
+        size_t last = first;
+        size_t cost = 0;
+        while (last < order.size() && cost < MIN_BATCH_TASK_POSTINGS) {
+            cost += costs[order[last++]];
+        }
+        tasks.push_back({first, last});
+        first = last;
+    }
+
+    const auto filter = [](int id, DocumentStatus status, int rating) {
+        (void)id;
+        (void)rating;
+        return status == DocumentStatus::ACTUAL;
+    };
+    for_each(execution::par, tasks.begin(), tasks.end(), [&](const Task& task) {
+        for (size_t i = task.first; i < task.last; ++i) {
+            const uint32_t query = order[i];
+            SortQueryTerms(queries[query].plus_terms);
+            documents[query] = FindTopDocuments(execution::seq, queries[query], filter,
+                                                0, MAX_RESULT_DOCUMENT_COUNT);
+            if (query_cache_) {
+                query_cache_->Insert(move(keys[query]), generation_, documents[query]);
+            }
+        }
+    });
+    return documents;
+}
+
+int SearchIndex::GetDocumentCount() const {
+    return document_ordinals_.size();
+}
+
+void SearchIndex::SetQueryCache(shared_ptr<QueryCache> query_cache) {
+    query_cache_ = move(query_cache);
+}
+
+tuple<vector<string_view>, DocumentStatus>
+SearchIndex::MatchDocument(const string_view raw_query, int document_id) const {
+    STAGE_LATENCY_SCOPE(timer, QueryStage::MATCH_DOCUMENT);
+    const int ordinal = GetDocumentOrdinal(document_id);
+    PooledQuery query;
+    ParseQuery(raw_query, *query);
+    ResolveMatchQuery(*query);
+    return {MatchOrdinal(*query, ordinal), ordinal_statuses_[ordinal]};
+}
+
+tuple<vector<string_view>, DocumentStatus>
+SearchIndex::MatchDocument(const execution::sequenced_policy &, const string_view raw_query, int document_id) const {
+    return MatchDocument(raw_query, document_id);
+}
+
+tuple<vector<string_view>, DocumentStatus>
+SearchIndex::MatchDocument(const execution::parallel_policy &, const string_view raw_query, int document_id) const {
+    STAGE_LATENCY_SCOPE(timer, QueryStage::MATCH_DOCUMENT);
+    const int ordinal = GetDocumentOrdinal(document_id);
+    const DocumentStatus status = ordinal_statuses_[ordinal];
+    PooledQuery pooled_query;
+    Query& query = *pooled_query;
+    ParseQuery(raw_query, query);
+    const size_t word_count = query.plus_words.size() + query.minus_words.size();
+    if (word_count < 2 * MIN_MATCH_TASK_WORDS) {
+        ResolveMatchQuery(query);
+        return {MatchOrdinal(query, ordinal), status};
+    }
+
+    // Every task looks up a range of words and intersects their term ids with
+    // the document. Minus words go first; the first minus word found sets the
+    // token, and the rest of the tasks stop at the next check
+    struct Task {
+        const vector<string_view>* words;
+        size_t first;
+        size_t last;
+        bool is_minus;
+        vector<string_view> matched_words;
+    };
+    vector<Task> tasks;
+    for (const bool is_minus : {true, false}) {
+        const vector<string_view>& words = is_minus ? query.minus_words : query.plus_words;
+        for (size_t first = 0; first < words.size(); first += MIN_MATCH_TASK_WORDS) {
+            tasks.push_back({&words, first, min(words.size(), first + MIN_MATCH_TASK_WORDS), is_minus, {}});
+        }
+    }
+    const TermId* document_first = ordinal_terms_.data() + ordinal_term_offsets_[ordinal];
+    const TermId* document_last = ordinal_terms_.data() + ordinal_term_offsets_[ordinal + 1];
+    atomic<bool> has_minus_word = false;
+    for_each(execution::par, tasks.begin(), tasks.end(), [&](Task& task) {
+        if (has_minus_word.load(memory_order_relaxed)) {
+            return;
+        }
+        vector<TermId> terms;
+        terms.reserve(task.last - task.first);
+        for (size_t i = task.first; i < task.last; ++i) {
+            const TermId term = FindIndexedTerm((*task.words)[i]);
+            if (term != TermDictionary::NO_TERM) {
+                terms.push_back(term);
+            }
+        }
+        sort(terms.begin(), terms.end());
+        IntersectSorted(terms.data(), terms.data() + terms.size(), document_first, document_last,
+            [this, &task, &has_minus_word](TermId term) {
+                if (task.is_minus) {
+                    has_minus_word.store(true, memory_order_relaxed);
+                    return false;
+                }
+                task.matched_words.push_back(terms_.GetTerm(term));
+                return !has_minus_word.load(memory_order_relaxed);
+            });
+    });
+    if (has_minus_word) {
+        return {vector<string_view>{}, status};
+    }
+
+    // words of the tasks are sorted, so matched words of a task are sorted
+    // once and go after the words of the previous tasks
+    vector<string_view> matched_words;
+    for (Task& task : tasks) {
+        sort(task.matched_words.begin(), task.matched_words.end());
+        matched_words.insert(matched_words.end(), task.matched_words.begin(), task.matched_words.end());
+    }
+    return {move(matched_words), status};
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>>
+SearchIndex::MatchDocuments(const string_view raw_query, const vector<int>& document_ids) const {
+    return MatchDocuments(execution::seq, raw_query, document_ids);
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>>
+SearchIndex::MatchDocuments(const execution::sequenced_policy&, const string_view raw_query,
+                            const vector<int>& document_ids) const {
+    STAGE_LATENCY_SCOPE(timer, QueryStage::MATCH_DOCUMENT);
+    vector<int> ordinals;
+    ordinals.reserve(document_ids.size());
+    for (const int document_id : document_ids) {
+        ordinals.push_back(GetDocumentOrdinal(document_id));
+    }
+    PooledQuery query;
+    ParseQuery(raw_query, *query);
+    ResolveMatchQuery(*query);
+    vector<tuple<vector<string_view>, DocumentStatus>> results;
+    results.reserve(ordinals.size());
+    for (const int ordinal : ordinals) {
+        results.emplace_back(MatchOrdinal(*query, ordinal), ordinal_statuses_[ordinal]);
+    }
+    return results;
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>>
+SearchIndex::MatchDocuments(const execution::parallel_policy&, const string_view raw_query,
+                            const vector<int>& document_ids) const {
+    STAGE_LATENCY_SCOPE(timer, QueryStage::MATCH_DOCUMENT);
+    vector<int> ordinals;
+    ordinals.reserve(document_ids.size());
+    for (const int document_id : document_ids) {
+        ordinals.push_back(GetDocumentOrdinal(document_id));
+    }
+    PooledQuery query;
+    ParseQuery(raw_query, *query);
+    ResolveMatchQuery(*query);
+    vector<tuple<vector<string_view>, DocumentStatus>> results(ordinals.size());
+    // the query is only read by the tasks
+    const Query& resolved_query = *query;
+    transform(execution::par, ordinals.begin(), ordinals.end(), results.begin(),
+        [this, &resolved_query](int ordinal) {
+            return tuple<vector<string_view>, DocumentStatus>{
+                MatchOrdinal(resolved_query, ordinal), ordinal_statuses_[ordinal]};
+        });
+    return results;
+}
+
+std::set<int>::const_iterator
+SearchIndex::begin() const {
+    return document_ids_.begin();
+}
+
+std::set<int>::const_iterator
+SearchIndex::end() const {
+    return document_ids_.end();
+}
+
+map<string_view, double>
+SearchIndex::GetWordFrequencies(int document_id) const {
+    map<string_view, double> word_freqs;
+    const auto ordinal_it = document_ordinals_.find(document_id);
+    if (ordinal_it == document_ordinals_.end()) {
+        return word_freqs;
+    }
+    const int ordinal = ordinal_it->second;
+    for (size_t i = ordinal_term_offsets_[ordinal]; i < ordinal_term_offsets_[ordinal + 1]; ++i) {
+        const TermId term = ordinal_terms_[i];
+        const int term_count = term_postings_[term].LowerBound(ordinal).TermCount();
+        word_freqs.emplace(terms_.GetTerm(term), term_count * ordinal_inv_word_counts_[ordinal]);
+    }
+    return word_freqs;
+}
+
+vector<int> SearchIndex::GetOrdinalsById() const {
+    vector<int> ordinals;
+    ordinals.reserve(document_ordinals_.size());
+    for (const auto [document_id, ordinal] : document_ordinals_) {
+        ordinals.push_back(ordinal);
+    }
+    return ordinals;
+}
+
+vector<int> SearchIndex::FindDuplicateDocuments() const {
+    // documents are referred to by indexes in the order of ids
+    const vector<int> ordinals = GetOrdinalsById();
+    const auto get_terms = [this, &ordinals](uint32_t index) {
+        const int ordinal = ordinals[index];
+        return make_pair(ordinal_terms_.data() + ordinal_term_offsets_[ordinal],
+                         ordinal_terms_.data() + ordinal_term_offsets_[ordinal + 1]);
+    };
+    vector<Fingerprint> fingerprints(ordinals.size());
+    vector<uint32_t> indexes(ordinals.size());
+    iota(indexes.begin(), indexes.end(), 0);
+    for_each(execution::par, indexes.begin(), indexes.end(), [&](uint32_t index) {
+        const auto [first, last] = get_terms(index);
+        fingerprints[index] = ComputeFingerprint(first, last);
+    });
+    sort(execution::par, indexes.begin(), indexes.end(), [&fingerprints](uint32_t lhs, uint32_t rhs) {
+        return fingerprints[lhs] < fingerprints[rhs]
+            || (fingerprints[lhs] == fingerprints[rhs] && lhs < rhs);
+    });
+
+    // the first document of a group is kept; others are compared with kept
+    // ones, as a collision of fingerprints doesn't make sets equal
+    vector<int> duplicate_ids;
+    vector<uint32_t> kept;
+    for (size_t first = 0; first < indexes.size();) {
+        size_t last = first + 1;
+        while (last < indexes.size() && fingerprints[indexes[last]] == fingerprints[indexes[first]]) {
+            ++last;
+        }
+        kept.assign(1, indexes[first]);
+        for (size_t i = first + 1; i < last; ++i) {
+            const auto [document_first, document_last] = get_terms(indexes[i]);
+            const bool is_duplicate = any_of(kept.begin(), kept.end(), [&](uint32_t kept_index) {
+                const auto [kept_first, kept_last] = get_terms(kept_index);
+                return equal(document_first, document_last, kept_first, kept_last);
+            });
+            if (is_duplicate) {
+                duplicate_ids.push_back(ordinal_document_ids_[ordinals[indexes[i]]]);
+            } else {
+                kept.push_back(indexes[i]);
+            }
+        }
+        first = last;
+    }
+    sort(duplicate_ids.begin(), duplicate_ids.end());
+    return duplicate_ids;
+}
+
+vector<int> SearchIndex::FindNearDuplicateDocuments(double min_similarity) const {
+    if (!(min_similarity > 0.0 && min_similarity <= 1.0)) {
+        throw invalid_argument("Similarity must be in (0, 1]"s);
+    }
+    // exact duplicates are found by fingerprints, so they don't make large
+    // groups of candidates
+    const vector<int> exact_duplicate_ids = FindDuplicateDocuments();
+    const vector<int> ordinals = GetOrdinalsById();
+    const auto get_terms = [this, &ordinals](uint32_t index) {
+        const int ordinal = ordinals[index];
+        return make_pair(ordinal_terms_.data() + ordinal_term_offsets_[ordinal],
+                         ordinal_terms_.data() + ordinal_term_offsets_[ordinal + 1]);
+    };
+    vector<char> is_duplicate(ordinals.size(), false);
+    vector<uint32_t> indexes;
+    indexes.reserve(ordinals.size());
+    for (uint32_t index = 0, i = 0; index < ordinals.size(); ++index) {
+        const int document_id = ordinal_document_ids_[ordinals[index]];
+        if (i < exact_duplicate_ids.size() && exact_duplicate_ids[i] == document_id) {
+            is_duplicate[index] = true;
+            ++i;
+        } else {
+            indexes.push_back(index);
+        }
+    }
+
+    // Bands are hashed one by one, so memory doesn't grow with the size of
+    // signatures. A pair of documents of a group is a candidate
+    struct BandKey {
+        uint64_t hash;
+        uint32_t index;
+    };
+    vector<BandKey> keys(indexes.size());
+    // (greater index, lesser index)
+    vector<pair<uint32_t, uint32_t>> candidates;
+    for (int band = 0; band < LSH_BANDS; ++band) {
+        transform(execution::par, indexes.begin(), indexes.end(), keys.begin(), [&](uint32_t index) {
+            const auto [first, last] = get_terms(index);
+            uint64_t hash = band;
+            for (int row = 0; row < LSH_ROWS; ++row) {
+                const uint64_t seed = MixHash(band * LSH_ROWS + row + 1);
+                uint64_t min_hash = UINT64_MAX;
+                for (const TermId* term = first; term != last; ++term) {
+                    min_hash = min(min_hash, MixHash(*term ^ seed));
+                }
+                hash = MixHash(hash ^ min_hash);
+            }
+            return BandKey{hash, index};
+        });
+        sort(execution::par, keys.begin(), keys.end(), [](const BandKey& lhs, const BandKey& rhs) {
+            return lhs.hash < rhs.hash || (lhs.hash == rhs.hash && lhs.index < rhs.index);
+        });
+        for (size_t first = 0; first < keys.size();) {
+            size_t last = first + 1;
+            while (last < keys.size() && keys[last].hash == keys[first].hash) {
+                ++last;
+            }
+            for (size_t i = first + 1; i < last; ++i) {
+                for (size_t j = first; j < i; ++j) {
+                    candidates.emplace_back(keys[i].index, keys[j].index);
+                }
+            }
+            first = last;
+        }
+    }
+    sort(execution::par, candidates.begin(), candidates.end());
+    candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+    // documents are checked in the order of ids: a document is a duplicate
+    // of a kept one only
+    vector<int> duplicate_ids = exact_duplicate_ids;
+    for (size_t first = 0; first < candidates.size();) {
+        const uint32_t index = candidates[first].first;
+        size_t last = first + 1;
+        while (last < candidates.size() && candidates[last].first == index) {
+            ++last;
+        }
+        const auto [document_first, document_last] = get_terms(index);
+        for (size_t i = first; i < last; ++i) {
+            const uint32_t other = candidates[i].second;
+            if (is_duplicate[other]) {
+                continue;
+            }
+            const auto [other_first, other_last] = get_terms(other);
+            if (ComputeJaccardSimilarity(document_first, document_last, other_first, other_last) >= min_similarity) {
+                is_duplicate[index] = true;
+                duplicate_ids.push_back(ordinal_document_ids_[ordinals[index]]);
+                break;
+            }
+        }
+        first = last;
+    }
+    sort(duplicate_ids.begin(), duplicate_ids.end());
+    return duplicate_ids;
+}
+
+double SearchIndex::GetInverseDocumentFreq(const string_view word) const {
+    const TermId term = FindIndexedTerm(word);
+    return term == TermDictionary::NO_TERM ? 0.0 : ComputeTermInverseDocumentFreq(term);
+}
+
+SearchIndex::TermId
+SearchIndex::FindIndexedTerm(const string_view word) const {
+    const TermId term = terms_.Find(word);
+    return term == TermDictionary::NO_TERM || term_document_freqs_[term] == 0
+        ? TermDictionary::NO_TERM : term;
+}
+
+
+bool SearchIndex::IsStopWord(const string_view word) const {
+    return stop_words_.Find(word) != TermDictionary::NO_TERM;
+}
+
+SearchIndex::DocumentWords
+SearchIndex::CountDocumentWords(const string_view text) const {
+    DocumentWords words;
+    vector<string_view> views;
+    if (!SplitIntoWordsView(text, views)) {
+        words.valid = false;
+        return words;
+    }
+    views.erase(remove_if(views.begin(), views.end(), [this](const string_view word) {
+        return IsStopWord(word);
+    }), views.end());
+    words.word_count = static_cast<int>(views.size());
+    sort(views.begin(), views.end());
+    for (const string_view word : views) {
+        if (words.word_counts.empty() || words.word_counts.back().first != word) {
+            words.word_counts.emplace_back(word, 1);
+        } else {
+            ++words.word_counts.back().second;
+        }
+    }
+    return words;
+}
+
+int SearchIndex::ComputeAverageRating(const vector<int>& ratings) {
+    if (ratings.empty()) {
+        return 0;
+    }
+    int rating_sum = accumulate(ratings.begin(), ratings.end(), 0);
+    return rating_sum / static_cast<int>(ratings.size());
+}
+
+namespace {
+// a few free queries are enough for nested queries
+const size_t MAX_FREE_QUERIES = 4;
+// accumulators take memory of the ordinal range, so fewer are kept
+const size_t MAX_FREE_ACCUMULATORS = 2;
+
+void SortUnique(vector<string_view>& words) {
+    sort(words.begin(), words.end());
+    words.erase(unique(words.begin(), words.end()), words.end());
+}
+}
+
+vector<unique_ptr<SearchIndex::Query>>& SearchIndex::PooledQuery::GetFreeQueries() {
+    thread_local vector<unique_ptr<Query>> free_queries;
+    return free_queries;
+}
+
+SearchIndex::PooledQuery::PooledQuery() {
+    auto& free_queries = GetFreeQueries();
+    if (free_queries.empty()) {
+        query_ = make_unique<Query>();
+    } else {
+        query_ = move(free_queries.back());
+        free_queries.pop_back();
+    }
+}
+
+SearchIndex::PooledQuery::~PooledQuery() {
+    auto& free_queries = GetFreeQueries();
+    if (free_queries.size() < MAX_FREE_QUERIES) {
+        free_queries.push_back(move(query_));
+    }
+}
+
+vector<unique_ptr<SearchIndex::Accumulator>>& SearchIndex::PooledAccumulator::GetFreeAccumulators() {
+    thread_local vector<unique_ptr<Accumulator>> free_accumulators;
+    return free_accumulators;
+}
+
+SearchIndex::PooledAccumulator::PooledAccumulator(int size) {
+    auto& free_accumulators = GetFreeAccumulators();
+    if (free_accumulators.empty()) {
+        accumulator_ = make_unique<Accumulator>();
+    } else {
+        accumulator_ = move(free_accumulators.back());
+        free_accumulators.pop_back();
+    }
+    // entries are zeroed once, when the accumulator grows
+    if (accumulator_->states.size() < static_cast<size_t>(size)) {
+        accumulator_->states.resize(size, Accumulator::UNSEEN);
+        accumulator_->relevance.resize(size, 0.0);
+    }
+}
+
+SearchIndex::PooledAccumulator::~PooledAccumulator() {
+    for (const int index : accumulator_->touched) {
+        accumulator_->states[index] = Accumulator::UNSEEN;
+        accumulator_->relevance[index] = 0.0;
+    }
+    accumulator_->touched.clear();
+    accumulator_->matched.clear();
+    auto& free_accumulators = GetFreeAccumulators();
+    if (free_accumulators.size() < MAX_FREE_ACCUMULATORS) {
+        free_accumulators.push_back(move(accumulator_));
+    }
+}
+
+void
+SearchIndex::ParseQuery(const string_view text, Query& query) const {
+    STAGE_LATENCY_SCOPE(timer, QueryStage::PARSE);
+    // words are split into plus_words, then minus and stop words are moved
+    // out of there
+    query.plus_words.clear();
+    query.minus_words.clear();
+    const bool is_valid = SplitIntoWordsView(text, query.plus_words);
+    size_t plus_word_count = 0;
+    for (string_view word : query.plus_words) {
+        bool is_minus = false;
+        if (word[0] == '-') {
+            if (word.size() < 2)
+                throw invalid_argument("Minus-word doesn't contain characters after '-'"s);
+            if (word[1] == '-')
+                throw invalid_argument("Minus-word starts with '--'"s);
+            is_minus = true;
+            word.remove_prefix(1);
+        }
+        if (!is_valid && !IsValidWord(word))
+            throw invalid_argument("Query word contains invalid character"s);
+        if (IsStopWord(word))
+            continue;
+        if (is_minus) {
+            query.minus_words.push_back(word);
+        } else {
+            query.plus_words[plus_word_count++] = word;
+        }
+    }
+    query.plus_words.resize(plus_word_count);
+    SortUnique(query.plus_words);
+    SortUnique(query.minus_words);
+}
+
+void SearchIndex::ResolveQuery(Query& query) const {
+    STAGE_LATENCY_SCOPE(timer, QueryStage::POSTING_FETCH);
+    query.minus_postings.clear();
+    query.plus_terms.clear();
+    for (const string_view word : query.minus_words) {
+        const TermId term = FindIndexedTerm(word);
+        if (term != TermDictionary::NO_TERM) {
+            query.minus_postings.push_back(&term_postings_[term]);
+        }
+    }
+    for (const string_view word : query.plus_words) {
+        const TermId term = FindIndexedTerm(word);
+        if (term != TermDictionary::NO_TERM) {
+            query.plus_terms.push_back(GetQueryTerm(term));
+        }
+    }
+    SortQueryTerms(query.plus_terms);
+}
+
+void SearchIndex::ResolveMatchQuery(Query& query) const {
+    STAGE_LATENCY_SCOPE(timer, QueryStage::POSTING_FETCH);
+    query.plus_term_ids.clear();
+    query.minus_term_ids.clear();
+    for (const string_view word : query.plus_words) {
+        const TermId term = FindIndexedTerm(word);
+        if (term != TermDictionary::NO_TERM) {
+            query.plus_term_ids.push_back(term);
+        }
+    }
+    for (const string_view word : query.minus_words) {
+        const TermId term = FindIndexedTerm(word);
+        if (term != TermDictionary::NO_TERM) {
+            query.minus_term_ids.push_back(term);
+        }
+    }
+    sort(query.plus_term_ids.begin(), query.plus_term_ids.end());
+    sort(query.minus_term_ids.begin(), query.minus_term_ids.end());
+}
+
+vector<string_view> SearchIndex::MatchOrdinal(const Query& query, int ordinal) const {
+    const TermId* document_first = ordinal_terms_.data() + ordinal_term_offsets_[ordinal];
+    const TermId* document_last = ordinal_terms_.data() + ordinal_term_offsets_[ordinal + 1];
+    vector<string_view> matched_words;
+    bool has_minus_word = false;
+    IntersectSorted(query.minus_term_ids.data(), query.minus_term_ids.data() + query.minus_term_ids.size(),
+        document_first, document_last, [&has_minus_word](TermId) {
+            has_minus_word = true;
+            return false;
+        });
+    if (has_minus_word) {
+        return matched_words;
+    }
+    IntersectSorted(query.plus_term_ids.data(), query.plus_term_ids.data() + query.plus_term_ids.size(),
+        document_first, document_last, [this, &matched_words](TermId term) {
+            matched_words.push_back(terms_.GetTerm(term));
+            return true;
+        });
+    // words are given in the order of term ids
+    sort(matched_words.begin(), matched_words.end());
+    return matched_words;
+}
+
+int SearchIndex::GetDocumentOrdinal(int document_id) const {
+    const auto ordinal_it = document_ordinals_.find(document_id);
+    if (ordinal_it == document_ordinals_.end())
+        throw std::out_of_range("document_id not found");
+    return ordinal_it->second;
+}
+
+SearchIndex::QueryTerm SearchIndex::GetQueryTerm(TermId term) const {
+    const PostingList& postings = term_postings_[term];
+    const double inverse_document_freq = ComputeTermInverseDocumentFreq(term);
+    return {&postings, inverse_document_freq, postings.GetMaxTermFreq() * inverse_document_freq};
+}
+
+void SearchIndex::SortQueryTerms(vector<QueryTerm>& terms) {
+    sort(terms.begin(), terms.end(), [](const QueryTerm& lhs, const QueryTerm& rhs) {
+        return lhs.max_score > rhs.max_score;
+    });
+}
+
+string SearchIndex::GetQueryCacheKey(const Query& query, DocumentStatus status,
+                                      size_t offset, size_t limit) {
+    // words can't contain control characters, so they separate the parts
+    string key;
+    for (const string_view word : query.plus_words) {
+        key += word;
+        key += '\x01';
+    }
+    key += '\x02';
+    for (const string_view word : query.minus_words) {
+        key += word;
+        key += '\x01';
+    }
+    key += '\x02';
+    key += to_string(static_cast<int>(status));
+    key += '\x01';
+    key += to_string(offset);
+    key += '\x01';
+    key += to_string(limit);
+    return key;
+}
+
+void SearchIndex::UpdateTermWeight(TermId term) {
+    const size_t docs_with_word = term_document_freqs_[term];
+    term_log_document_freqs_[term] = docs_with_word == 0 ? 0.0 : log(static_cast<double>(docs_with_word));
+}
+
+void SearchIndex::UpdateDocumentCountWeight() {
+    const int document_count = GetDocumentCount();
+    log_document_count_ = document_count == 0 ? 0.0 : log(static_cast<double>(document_count));
+}
+
+bool SearchIndex::IsMoreRelevant(const Document& lhs, const Document& rhs) {
+    // always use std:abs
+    if (std::abs(lhs.relevance - rhs.relevance) < RELEVANCE_EPS) {
+        return lhs.rating > rhs.rating;
+    } else {
+        return lhs.relevance > rhs.relevance;
+    }
+}
+
+void SearchIndex::SelectTopDocuments(vector<Document>& documents, size_t offset, size_t limit) {
+    if (offset >= documents.size()) {
+        documents.clear();
+        return;
+    }
+    const size_t count = offset + min(limit, documents.size() - offset);
+    // O(N): move count most relevant documents to the front, drop the rest
+    if (count < documents.size()) {
+        nth_element(documents.begin(), documents.begin() + count, documents.end(),
+                    IsMoreRelevant);
+        documents.erase(documents.begin() + count, documents.end());
+    }
+    // O(count): separate the window from the documents before it
+    if (offset > 0) {
+        nth_element(documents.begin(), documents.begin() + offset, documents.end(),
+                    IsMoreRelevant);
+        documents.erase(documents.begin(), documents.begin() + offset);
+    }
+    // O(limit*log(limit)): sort the window only
+    sort(documents.begin(), documents.end(), IsMoreRelevant);
+}
+
+bool SearchIndex::IsValidWord(const string_view word) {
+    // A valid word must not contain special characters
+    return !HasControlCharacters(word);
+}
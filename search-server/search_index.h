@@ -0,0 +1,769 @@
+#pragma once
+
+#include <algorithm>
+#include <execution>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <string_view>
+#include <cassert>
+#include <cstdint>
+
+// SF.7: Don’t write using namespace at global scope in a header file
+// https://isocpp.github.io/CppCoreGuidelines/CppCoreGuidelines#Rs-using-directive
+
+#include "document.h"
+#include "posting_list.h"
+#include "query_cache.h"
+#include "stage_latency.h"
+#include "term_dictionary.h"
+
+static inline const double RELEVANCE_EPS = 1e-6;
+static inline const int MAX_RESULT_DOCUMENT_COUNT = 5;
+
+// Inverted index of documents; it isn't thread-safe for writes, use
+// SearchServer to query the index while it is changed
+class SearchIndex {
+
+public:
+    template <typename StringContainer>
+    explicit SearchIndex(const StringContainer& stop_words);
+    
+    explicit SearchIndex(const std::string& stop_words);
+    explicit SearchIndex(const std::string_view stop_words);
+
+    SearchIndex() = default;
+
+    void AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+
+    // Add documents of the range; elements are (id, text, status, ratings)
+    // tuples or structures. Documents are tokenized in parallel and merged
+    // into the index word by word. If any document is invalid, throw
+    // std::invalid_argument and add nothing
+    template <typename ExecutionPolicy, typename DocumentRange>
+    void AddDocuments(ExecutionPolicy&& policy, const DocumentRange& documents);
+
+    template <typename DocumentRange>
+    void AddDocuments(const DocumentRange& documents);
+
+    template <typename Filter, typename ExecutionPolicy>
+    std::vector<Document>
+    FindTopDocuments(ExecutionPolicy&& policy,
+                     const std::string_view raw_query, Filter filter) const;
+
+    template <typename Filter>
+    std::vector<Document>
+    FindTopDocuments(const std::string_view raw_query, Filter filter) const;
+
+    // overload FindTopDocuments with no parameters (return actual documents)
+    template<typename ExecutionPolicy>
+    std::vector<Document>
+    FindTopDocuments(ExecutionPolicy&& policy,
+                     const std::string_view raw_query) const;
+
+    std::vector<Document>
+    FindTopDocuments(const std::string_view raw_query) const;
+
+    // overload FindTopDocuments with status parameter only
+    template<typename ExecutionPolicy>
+    std::vector<Document>
+    FindTopDocuments(ExecutionPolicy&& policy,
+                     const std::string_view raw_query, DocumentStatus status) const;
+
+    std::vector<Document>
+    FindTopDocuments(const std::string_view raw_query, DocumentStatus status) const;
+
+    // overloads FindTopDocuments with window of results: return documents
+    // from offset to offset + limit in the order of relevance
+    template <typename Filter, typename ExecutionPolicy>
+    std::vector<Document>
+    FindTopDocuments(ExecutionPolicy&& policy,
+                     const std::string_view raw_query, Filter filter,
+                     size_t offset, size_t limit) const;
+
+    template <typename Filter>
+    std::vector<Document>
+    FindTopDocuments(const std::string_view raw_query, Filter filter,
+                     size_t offset, size_t limit) const;
+
+    template<typename ExecutionPolicy>
+    std::vector<Document>
+    FindTopDocuments(ExecutionPolicy&& policy,
+                     const std::string_view raw_query, DocumentStatus status,
+                     size_t offset, size_t limit) const;
+
+    std::vector<Document>
+    FindTopDocuments(const std::string_view raw_query, DocumentStatus status,
+                     size_t offset, size_t limit) const;
+
+    // Find top actual documents for every query. Words shared by the queries
+    // are looked up once; queries are scored in parallel, small queries are
+    // grouped into one task. Throw std::invalid_argument if a query is invalid
+    std::vector<std::vector<Document>>
+    FindTopDocumentsBatch(const std::vector<std::string>& raw_queries) const;
+
+    std::vector<std::vector<Document>>
+    FindTopDocumentsBatch(const std::vector<std::string_view>& raw_queries) const;
+
+    int GetDocumentCount() const;
+
+    // Cache results of queries filtered by status (queries with a predicate
+    // are not cached); nullptr disables the cache. Cached results are dropped
+    // when documents are added or removed. Indexes with equal documents may
+    // share a cache
+    void SetQueryCache(std::shared_ptr<QueryCache> query_cache);
+
+    // log(document count / count of documents with the word) or 0 if no
+    // document contains the word; it is cached, so no log is computed
+    double GetInverseDocumentFreq(const std::string_view word) const;
+    
+    std::tuple<std::vector<std::string_view>, DocumentStatus>
+    MatchDocument(const std::string_view raw_query, int document_id) const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus>
+    MatchDocument(const std::execution::sequenced_policy& policy, const std::string_view raw_query, int document_id) const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus>
+    MatchDocument(const std::execution::parallel_policy& policy, const std::string_view raw_query, int document_id) const;
+
+    // Match the query against every document of document_ids, the query is
+    // parsed once. Throw std::out_of_range if a document is not found
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>
+    MatchDocuments(const std::string_view raw_query, const std::vector<int>& document_ids) const;
+
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>
+    MatchDocuments(const std::execution::sequenced_policy& policy, const std::string_view raw_query,
+                   const std::vector<int>& document_ids) const;
+
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>
+    MatchDocuments(const std::execution::parallel_policy& policy, const std::string_view raw_query,
+                   const std::vector<int>& document_ids) const;
+
+    std::set<int>::const_iterator begin() const;
+
+    std::set<int>::const_iterator end() const;
+
+    // Frequencies are computed from the index, so the map is returned by value
+    std::map<std::string_view, double> GetWordFrequencies(int document_id) const;
+
+    // Ids of documents with the same set of words as a document with a
+    // lesser id, in ascending order. Documents are grouped by 128-bit
+    // fingerprints of their sorted term ids in parallel, sets of a group are
+    // compared then, so the search is exact
+    std::vector<int> FindDuplicateDocuments() const;
+
+    // Ids of documents whose Jaccard similarity of sets of words with a kept
+    // document with a lesser id is at least min_similarity, in ascending
+    // order. Candidates are found by MinHash with locality-sensitive hashing
+    // and similarity of candidates is computed exactly, so there are no
+    // false positives; pairs with similarity about 0.5 and less may be
+    // missed. Throw std::invalid_argument unless 0 < min_similarity <= 1
+    std::vector<int> FindNearDuplicateDocuments(double min_similarity) const;
+
+    void RemoveDocument(int document_id);
+
+    template <typename ExecutionPolicy>
+    void RemoveDocument(ExecutionPolicy ep, int document_id);
+
+    // Remove documents in one pass: terms of the documents are grouped, so
+    // the weight of every term is updated once. Unknown ids are skipped
+    void RemoveDocuments(const std::vector<int>& document_ids);
+
+    template <typename ExecutionPolicy>
+    void RemoveDocuments(ExecutionPolicy policy, const std::vector<int>& document_ids);
+
+    // Removed documents are marked in a tombstone bitset and their postings
+    // are dropped by Compact later. Compaction is worth it when postings of
+    // removed documents make a notable share of the index
+    bool NeedsCompaction() const;
+
+    // Rewrite posting lists without postings of removed documents; lists of
+    // terms left in no document are released without decoding
+    void Compact();
+
+    // Write the index to a binary snapshot file; throw std::runtime_error on
+    // I/O errors
+    void SaveSnapshot(const std::string& path) const;
+
+    // Read the index from a snapshot written by SaveSnapshot. The file is
+    // mapped into memory and posting lists are read from the mapping without
+    // copying, so no document is tokenized again. Throw std::runtime_error if
+    // the file can't be read, isn't a snapshot of this version and byte
+    // order, or is corrupted
+    static SearchIndex LoadSnapshot(const std::string& path);
+
+private:
+    using TermId = TermDictionary::TermId;
+
+    TermDictionary stop_words_;
+    // words of the documents; a term stays after its documents are removed
+    TermDictionary terms_;
+    // posting lists by term id; they contain document ordinals, not ids.
+    // Postings of removed documents stay in the lists until Compact
+    std::vector<PostingList> term_postings_;
+    // count of live documents with the term
+    std::vector<uint32_t> term_document_freqs_;
+    // Inverse document frequency is log(document count) - log(df). log(df)
+    // is cached by term id and updated for the terms touched by adding or
+    // removing documents, so queries compute no logarithms
+    std::vector<double> term_log_document_freqs_;
+    double log_document_count_ = 0.0;
+    // external document id -> internal dense ordinal
+    // ordinal of a removed document is never reused
+    std::map<int, int> document_ordinals_;
+    // document columns indexed by ordinal
+    std::vector<int> ordinal_document_ids_;
+    std::vector<int> ordinal_ratings_;
+    std::vector<DocumentStatus> ordinal_statuses_;
+    // term frequency is term count multiplied by inverse word count
+    std::vector<double> ordinal_inv_word_counts_;
+    // forward index: sorted terms of the document with ordinal i are
+    // ordinal_terms_[ordinal_term_offsets_[i], ordinal_term_offsets_[i + 1]);
+    // terms of removed documents are not used anymore
+    std::vector<size_t> ordinal_term_offsets_ = {0};
+    std::vector<TermId> ordinal_terms_;
+    // bit per ordinal, set for removed documents
+    std::vector<uint64_t> ordinal_tombstones_;
+    // postings in the lists and postings of removed documents among them
+    size_t posting_count_ = 0;
+    size_t removed_posting_count_ = 0;
+    std::set<int> document_ids_;
+    // changed by every change of documents
+    uint64_t generation_ = 0;
+    std::shared_ptr<QueryCache> query_cache_;
+
+    bool IsStopWord(const std::string_view word) const;
+    bool IsRemoved(int ordinal) const {
+        return (ordinal_tombstones_[ordinal / 64] >> (ordinal % 64)) & 1;
+    }
+    // Id of the word if it is in some document, NO_TERM otherwise
+    TermId FindIndexedTerm(const std::string_view word) const;
+    static int ComputeAverageRating(const std::vector<int>& ratings);
+
+    struct DocumentToAdd {
+        int id;
+        std::string_view text;
+        DocumentStatus status;
+        int rating;
+    };
+
+    // Distinct words of a document with their counts
+    struct DocumentWords {
+        // views of the document text sorted by word
+        std::vector<std::pair<std::string_view, int>> word_counts;
+        int word_count = 0;
+        bool valid = true;
+    };
+
+    // Split text into words without stop words and count them
+    DocumentWords CountDocumentWords(const std::string_view text) const;
+
+    // Add documents: ids are checked and documents are tokenized first, then
+    // postings are grouped by word, so every word is looked up once
+    template <typename ExecutionPolicy>
+    void AddDocumentBatch(ExecutionPolicy policy, const std::vector<DocumentToAdd>& documents);
+    
+    // plus word found in the index with its weights
+    struct QueryTerm {
+        const PostingList* postings;
+        double inverse_document_freq;
+        double max_score;
+    };
+
+    struct Query {
+        // views of the raw query, sorted and unique
+        std::vector<std::string_view> plus_words;
+        std::vector<std::string_view> minus_words;
+        // words found in the index, plus terms are sorted by max score
+        std::vector<const PostingList*> minus_postings;
+        std::vector<QueryTerm> plus_terms;
+        // ids of the words found in the index, sorted; used for matching
+        std::vector<TermId> plus_term_ids;
+        std::vector<TermId> minus_term_ids;
+    };
+
+    // Query taken from a thread-local pool and returned there on destruction,
+    // so parsing doesn't allocate once the buffers have grown. A pool instead
+    // of a single buffer keeps queries nested in one thread (tasks stolen
+    // while waiting for a parallel algorithm) safe
+    class PooledQuery {
+    public:
+        PooledQuery();
+        ~PooledQuery();
+        PooledQuery(const PooledQuery&) = delete;
+        PooledQuery& operator=(const PooledQuery&) = delete;
+
+        Query& operator*() {
+            return *query_;
+        }
+
+    private:
+        std::unique_ptr<Query> query_;
+
+        // free queries of the calling thread
+        static std::vector<std::unique_ptr<Query>>& GetFreeQueries();
+    };
+
+    // Dense accumulator of FindCandidateDocuments indexed by ordinal minus
+    // the first ordinal of the range. Between queries all entries are UNSEEN
+    // and zero: a query resets only the entries it touched, so it costs as
+    // much as its postings, not as the range
+    struct Accumulator {
+        enum State : char { UNSEEN, MATCHED, REJECTED };
+
+        std::vector<State> states;
+        std::vector<double> relevance;
+        // indexes which are not UNSEEN, and MATCHED ones among them, in the
+        // order they were seen
+        std::vector<int> touched;
+        std::vector<int> matched;
+        // heap of the greatest relevances for the threshold
+        std::vector<double> top;
+    };
+
+    // Accumulator of at least size entries taken from a thread-local pool
+    // like PooledQuery; touched entries are reset on destruction
+    class PooledAccumulator {
+    public:
+        explicit PooledAccumulator(int size);
+        ~PooledAccumulator();
+        PooledAccumulator(const PooledAccumulator&) = delete;
+        PooledAccumulator& operator=(const PooledAccumulator&) = delete;
+
+        Accumulator* operator->() {
+            return accumulator_.get();
+        }
+
+    private:
+        std::unique_ptr<Accumulator> accumulator_;
+
+        // free accumulators of the calling thread
+        static std::vector<std::unique_ptr<Accumulator>>& GetFreeAccumulators();
+    };
+
+    // Parse the query into views of text in a single pass over characters;
+    // text must outlive the query
+    void ParseQuery(const std::string_view text, Query& query) const;
+
+    // Find words of the parsed query in the index
+    void ResolveQuery(Query& query) const;
+    QueryTerm GetQueryTerm(TermId term) const;
+    // Find term ids of the parsed query for matching
+    void ResolveMatchQuery(Query& query) const;
+
+    // Words of the resolved query found in the document, sorted, or no words
+    // if the document has a minus word. Term ids of the query are
+    // intersected with the forward index of the document
+    std::vector<std::string_view> MatchOrdinal(const Query& query, int ordinal) const;
+    int GetDocumentOrdinal(int document_id) const;
+    // Order of the terms processing: the most valuable first
+    static void SortQueryTerms(std::vector<QueryTerm>& terms);
+
+    // Normalized query: sorted unique words and parameters of the search
+    static std::string GetQueryCacheKey(const Query& query, DocumentStatus status,
+                                        size_t offset, size_t limit);
+
+    // Ordinals of the documents in the order of ids
+    std::vector<int> GetOrdinalsById() const;
+
+    // Term must be in some document
+    double ComputeTermInverseDocumentFreq(TermId term) const {
+        return log_document_count_ - term_log_document_freqs_[term];
+    }
+    void UpdateTermWeight(TermId term);
+    void UpdateDocumentCountWeight();
+
+    // Find documents from offset to offset + limit sorted by relevance
+    template <typename Filter>
+    std::vector<Document>
+    FindTopDocuments(const std::execution::sequenced_policy&,
+                     const Query& query, Filter filter,
+                     size_t offset, size_t limit) const;
+
+    template <typename Filter>
+    std::vector<Document>
+    FindTopDocuments(const std::execution::parallel_policy&,
+                     const Query& query, Filter filter,
+                     size_t offset, size_t limit) const;
+
+    // Minimal number of ordinals processed by one parallel task
+    static constexpr int MIN_ORDINAL_STRIPE_SIZE = 4096;
+    // Minimal number of postings scanned by one task of a query batch
+    static constexpr size_t MIN_BATCH_TASK_POSTINGS = 64 * 1024;
+
+    // Find documents with ordinals from [first_ordinal, last_ordinal) which
+    // may be among count most relevant ones of the range. Documents which
+    // can't get there may be skipped. Time of the stages is added to
+    // durations of the request
+    template <typename Filter>
+    std::vector<Document>
+    FindCandidateDocuments(const Query& query, Filter filter,
+                           int first_ordinal, int last_ordinal, size_t count,
+                           StageDurations& durations) const;
+
+    // Order of documents in search results
+    static bool IsMoreRelevant(const Document& lhs, const Document& rhs);
+
+    // Keep only documents from offset to offset + limit in the order of
+    // relevance and sort them
+    static void SelectTopDocuments(std::vector<Document>& documents,
+                                   size_t offset, size_t limit);
+
+    static bool IsValidWord(const std::string_view word);
+};
+
+template <typename StringContainer>
+SearchIndex::SearchIndex(const StringContainer& stop_words) {
+    using namespace std::literals;
+    for (const std::string_view word : stop_words) {
+        if (!IsValidWord(word))
+            throw std::invalid_argument("Stop-word contains invalid character"s);
+        if (!word.empty()) {
+            stop_words_.Insert(word);
+        }
+    }
+}
+
+template <typename ExecutionPolicy, typename DocumentRange>
+void SearchIndex::AddDocuments(ExecutionPolicy&& policy, const DocumentRange& documents) {
+    std::vector<DocumentToAdd> batch;
+    for (const auto& document : documents) {
+        const auto& [document_id, text, status, ratings] = document;
+        batch.push_back({document_id, std::string_view(text), status, ComputeAverageRating(ratings)});
+    }
+    AddDocumentBatch(std::forward<ExecutionPolicy>(policy), batch);
+}
+
+template <typename DocumentRange>
+void SearchIndex::AddDocuments(const DocumentRange& documents) {
+    AddDocuments(std::execution::seq, documents);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document>
+SearchIndex::FindTopDocuments(ExecutionPolicy&& policy,
+                               const std::string_view raw_query) const
+{
+    return FindTopDocuments(std::forward<ExecutionPolicy>(policy), raw_query,
+                            DocumentStatus::ACTUAL);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document>
+SearchIndex::FindTopDocuments(ExecutionPolicy&& policy,
+                               const std::string_view raw_query, DocumentStatus status) const
+{
+    return FindTopDocuments(std::forward<ExecutionPolicy>(policy), raw_query, status,
+                            0, MAX_RESULT_DOCUMENT_COUNT);
+}
+
+
+template <typename Filter, typename ExecutionPolicy>
+std::vector<Document>
+SearchIndex::FindTopDocuments(ExecutionPolicy&& policy,
+                               const std::string_view raw_query, Filter filter) const {            
+    return FindTopDocuments(std::forward<ExecutionPolicy>(policy), raw_query, filter,
+                            0, MAX_RESULT_DOCUMENT_COUNT);
+}
+
+template <typename Filter>
+std::vector<Document>
+SearchIndex::FindTopDocuments(const std::string_view raw_query, Filter filter) const {
+    
+    return FindTopDocuments(std::execution::seq, raw_query, filter);
+}
+
+template <typename Filter, typename ExecutionPolicy>
+std::vector<Document>
+SearchIndex::FindTopDocuments(ExecutionPolicy&& policy,
+                               const std::string_view raw_query, Filter filter,
+                               size_t offset, size_t limit) const {
+    STAGE_LATENCY_SCOPE(timer, QueryStage::FIND_TOP_DOCUMENTS);
+    PooledQuery query;
+    ParseQuery(raw_query, *query);
+    ResolveQuery(*query);
+    return FindTopDocuments(policy, *query, filter, offset, limit);
+}
+
+template <typename Filter>
+std::vector<Document>
+SearchIndex::FindTopDocuments(const std::string_view raw_query, Filter filter,
+                               size_t offset, size_t limit) const {
+    return FindTopDocuments(std::execution::seq, raw_query, filter, offset, limit);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document>
+SearchIndex::FindTopDocuments(ExecutionPolicy&& policy,
+                               const std::string_view raw_query, DocumentStatus status,
+                               size_t offset, size_t limit) const {
+    const auto filter = [status](int id, DocumentStatus st, int rating) {
+        (void)id;
+        (void)rating;
+        return st == status;};
+    STAGE_LATENCY_SCOPE(timer, QueryStage::FIND_TOP_DOCUMENTS);
+    PooledQuery query;
+    ParseQuery(raw_query, *query);
+    if (!query_cache_) {
+        ResolveQuery(*query);
+        return FindTopDocuments(policy, *query, filter, offset, limit);
+    }
+    std::string key = GetQueryCacheKey(*query, status, offset, limit);
+    std::vector<Document> documents;
+    if (query_cache_->Find(key, generation_, documents)) {
+        return documents;
+    }
+    ResolveQuery(*query);
+    documents = FindTopDocuments(policy, *query, filter, offset, limit);
+    query_cache_->Insert(std::move(key), generation_, documents);
+    return documents;
+}
+
+
+template <typename Filter>
+std::vector<Document>
+SearchIndex::FindTopDocuments(const std::execution::sequenced_policy&,
+                               const Query& query, Filter filter,
+                               size_t offset, size_t limit) const {
+    const size_t count = offset + std::min(limit, SIZE_MAX - offset);
+    StageDurations durations;
+    auto matched_documents = FindCandidateDocuments(query, filter,
+        0, static_cast<int>(ordinal_document_ids_.size()), count, durations);
+    {
+        STAGE_LATENCY_PART(timer, QueryStage::TOP_K, durations);
+        SelectTopDocuments(matched_documents, offset, limit);
+    }
+    durations.Record();
+    return matched_documents;
+}
+
+template <typename Filter>
+std::vector<Document>
+SearchIndex::FindTopDocuments(const std::execution::parallel_policy&,
+                               const Query& query, Filter filter,
+                               size_t offset, size_t limit) const {
+    // documents before the window are needed to find the window
+    const size_t count = offset + std::min(limit, SIZE_MAX - offset);
+    // Split ordinals into stripes. Every task accumulates relevance of its own
+    // stripe only, so tasks share nothing: no locks and no merge of maps.
+    const int ordinal_count = static_cast<int>(ordinal_document_ids_.size());
+    const int stripe_count = std::max(1, ordinal_count / MIN_ORDINAL_STRIPE_SIZE);
+    std::vector<std::vector<Document>> stripe_documents(stripe_count);
+    std::vector<int> stripes(stripe_count);
+    std::iota(stripes.begin(), stripes.end(), 0);
+    // stages of the stripes are summed and recorded once for the request
+    StageDurations durations;
+    std::for_each(
+        std::execution::par,
+        stripes.begin(), stripes.end(),
+        [this, &query, &filter, &stripe_documents, &durations, ordinal_count, stripe_count, count](int stripe) {
+            const int first = static_cast<int>(static_cast<int64_t>(ordinal_count) * stripe / stripe_count);
+            const int last = static_cast<int>(static_cast<int64_t>(ordinal_count) * (stripe + 1) / stripe_count);
+            stripe_documents[stripe] = FindCandidateDocuments(query, filter, first, last, count, durations);
+            // top documents of the stripe are enough to find the top of all
+            STAGE_LATENCY_PART(timer, QueryStage::TOP_K, durations);
+            SelectTopDocuments(stripe_documents[stripe], 0, count);
+        });
+
+    std::vector<Document> matched_documents;
+    {
+        STAGE_LATENCY_PART(timer, QueryStage::TOP_K, durations);
+        for (auto& documents : stripe_documents) {
+            matched_documents.insert(matched_documents.end(), documents.begin(), documents.end());
+        }
+        SelectTopDocuments(matched_documents, offset, limit);
+    }
+    durations.Record();
+    return matched_documents;
+}
+
+template <typename Filter>
+std::vector<Document>
+SearchIndex::FindCandidateDocuments(const Query& query, Filter filter,
+                                     int first_ordinal, int last_ordinal, size_t count,
+                                     [[maybe_unused]] StageDurations& durations) const {
+    // Term-at-a-time MaxScore: words are processed from the most valuable
+    // one; when the rest of the words can't lift an unseen document to the
+    // top, only the documents that still can get there are scored.
+    std::vector<Document> candidates;
+    const int size = last_ordinal - first_ordinal;
+    if (count == 0 || size <= 0) {
+        return candidates;
+    }
+
+    const std::vector<QueryTerm>& terms = query.plus_terms;
+    if (terms.empty()) {
+        return candidates;
+    }
+
+    STAGE_LATENCY_PART(timer, QueryStage::MINUS_FILTERING, durations);
+    PooledAccumulator accumulator(size);
+    std::vector<Accumulator::State>& states = accumulator->states;
+    std::vector<double>& relevance = accumulator->relevance;
+    std::vector<int>& touched = accumulator->touched;
+    std::vector<int>& matched = accumulator->matched;
+    // Documents with minus words are rejected before scoring, so scoring
+    // tests a state once per document. Removed documents (postings are kept
+    // until compaction) are looked up in the tombstones when first seen
+    for (const PostingList* postings : query.minus_postings) {
+        postings->ForEach(first_ordinal, last_ordinal,
+            [&states, &touched, first_ordinal](int ordinal, int) {
+                const int index = ordinal - first_ordinal;
+                if (states[index] == Accumulator::UNSEEN) {
+                    states[index] = Accumulator::REJECTED;
+                    touched.push_back(index);
+                }
+            });
+    }
+
+    STAGE_LATENCY_NEXT(timer, QueryStage::SCORING);
+    // upper bound of relevance gained from the words starting with i-th
+    std::vector<double> remaining_score(terms.size() + 1, 0.0);
+    for (size_t i = terms.size(); i > 0; --i) {
+        remaining_score[i - 1] = remaining_score[i] + terms[i - 1].max_score;
+    }
+
+    // Relevance of the count-th document minus RELEVANCE_EPS: documents
+    // which don't exceed it are not in the result. Relevance only grows with
+    // next words, so the value remains a valid lower bound.
+    std::vector<double>& top = accumulator->top;
+    const auto compute_threshold = [&top, &matched, &relevance, count]() {
+        // min-heap of count greatest relevances
+        top.clear();
+        for (const int index : matched) {
+            if (top.size() < count) {
+                top.push_back(relevance[index]);
+                std::push_heap(top.begin(), top.end(), std::greater<double>());
+            } else if (relevance[index] > top.front()) {
+                std::pop_heap(top.begin(), top.end(), std::greater<double>());
+                top.back() = relevance[index];
+                std::push_heap(top.begin(), top.end(), std::greater<double>());
+            }
+        }
+        return top.size() < count
+            ? -std::numeric_limits<double>::infinity()
+            : top.front() - RELEVANCE_EPS;
+    };
+
+    double threshold = -std::numeric_limits<double>::infinity();
+    // the threshold is computed for O(matched documents), so it is computed
+    // when it is expected to exceed the rest of the words weight; expectation
+    // assumes the threshold grows in proportion to the processed words weight
+    // (a range without count matched documents is not checked twice)
+    double expected_threshold = std::numeric_limits<double>::infinity();
+    double checked_score = 0.0;
+    size_t term_index = 0;
+    for (; term_index < terms.size(); ++term_index) {
+        const double processed_score = remaining_score[0] - remaining_score[term_index];
+        // Invariant: a document unseen so far can gain at most
+        // remaining_score[term_index], the sum of max scores of the rest of
+        // the words, so it is safe to stop once that bound falls below the
+        // threshold. The threshold can't exceed processed_score (the greatest
+        // relevance gained so far), so it isn't computed before the bound
+        // falls below processed_score
+        if (remaining_score[term_index] < std::min(processed_score, expected_threshold)) {
+            threshold = compute_threshold();
+            if (remaining_score[term_index] < threshold) {
+                // no unseen document can get to the top anymore
+                break;
+            }
+            checked_score = processed_score;
+        }
+        if (checked_score > 0) {
+            expected_threshold = std::max(threshold, 0.0) * processed_score / checked_score;
+        }
+        const double inverse_document_freq = terms[term_index].inverse_document_freq;
+        terms[term_index].postings->ForEach(first_ordinal, last_ordinal,
+            [&](int ordinal, int term_count) {
+                const int index = ordinal - first_ordinal;
+                if (states[index] == Accumulator::UNSEEN) {
+                    touched.push_back(index);
+                    if (!IsRemoved(ordinal)
+                        && filter(ordinal_document_ids_[ordinal], ordinal_statuses_[ordinal], ordinal_ratings_[ordinal])) {
+                        states[index] = Accumulator::MATCHED;
+                        matched.push_back(index);
+                    } else {
+                        states[index] = Accumulator::REJECTED;
+                    }
+                }
+                if (states[index] == Accumulator::MATCHED) {
+                    const double term_freq = term_count * ordinal_inv_word_counts_[ordinal];
+                    relevance[index] += term_freq * inverse_document_freq;
+                }
+            });
+    }
+
+    // documents which may get to the top in the order of ordinals, the rest
+    // are rejected; few matched documents are sorted, many are picked by a
+    // scan of the range, which is cheaper then
+    std::vector<int> indexes;
+    const double min_relevance = threshold - remaining_score[term_index];
+    if (matched.size() * 16 < static_cast<size_t>(size)) {
+        for (const int index : matched) {
+            if (relevance[index] >= min_relevance) {
+                indexes.push_back(index);
+            } else {
+                states[index] = Accumulator::REJECTED;
+            }
+        }
+        std::sort(indexes.begin(), indexes.end());
+    } else {
+        for (int index = 0; index < size; ++index) {
+            if (states[index] == Accumulator::MATCHED) {
+                if (relevance[index] >= min_relevance) {
+                    indexes.push_back(index);
+                } else {
+                    states[index] = Accumulator::REJECTED;
+                }
+            }
+        }
+    }
+
+    // the rest of the words: score the candidates only
+    for (; term_index < terms.size(); ++term_index) {
+        const QueryTerm& term = terms[term_index];
+        if (indexes.size() * 4 < term.postings->size()) {
+            // few candidates: jump over the postings
+            auto cursor = term.postings->LowerBound(first_ordinal);
+            for (const int index : indexes) {
+                const int ordinal = first_ordinal + index;
+                cursor.Seek(ordinal);
+                if (cursor.AtEnd() || cursor.Ordinal() >= last_ordinal) {
+                    break;
+                }
+                if (cursor.Ordinal() == ordinal) {
+                    const double term_freq = cursor.TermCount() * ordinal_inv_word_counts_[ordinal];
+                    relevance[index] += term_freq * term.inverse_document_freq;
+                }
+            }
+        } else {
+            term.postings->ForEach(first_ordinal, last_ordinal,
+                [&](int ordinal, int term_count) {
+                    const int index = ordinal - first_ordinal;
+                    if (states[index] == Accumulator::MATCHED) {
+                        const double term_freq = term_count * ordinal_inv_word_counts_[ordinal];
+                        relevance[index] += term_freq * term.inverse_document_freq;
+                    }
+                });
+        }
+    }
+
+    STAGE_LATENCY_NEXT(timer, QueryStage::RESULT_BUILD);
+    candidates.reserve(indexes.size());
+    for (const int index : indexes) {
+        const int ordinal = first_ordinal + index;
+        candidates.push_back({
+            ordinal_document_ids_[ordinal],
+            relevance[index],
+            ordinal_ratings_[ordinal]
+        });
+    }
+    return candidates;
+}
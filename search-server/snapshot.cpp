@@ -0,0 +1,117 @@
+#include "snapshot.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+MappedFile::MappedFile(const string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Can't open snapshot "s + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw runtime_error("Can't stat snapshot "s + path);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+        data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    // the mapping stays valid after the file is closed
+    close(fd);
+    if (data_ == MAP_FAILED) {
+        data_ = nullptr;
+        throw runtime_error("Can't map snapshot "s + path);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+    }
+}
+
+const uint8_t* MappedFile::data() const {
+    return static_cast<const uint8_t*>(data_);
+}
+
+size_t MappedFile::size() const {
+    return size_;
+}
+
+SnapshotWriter::SnapshotWriter(const string& path)
+    : path_(path)
+    , temp_path_(path + ".XXXXXX"s) {
+    // a unique name, so that concurrent saves don't write the same file
+    const int fd = mkstemp(temp_path_.data());
+    if (fd < 0) {
+        throw runtime_error("Can't create snapshot "s + path);
+    }
+    // mkstemp creates the file readable by the owner only
+    fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    close(fd);
+    out_.open(temp_path_, ios::binary | ios::trunc);
+    if (!out_) {
+        remove(temp_path_.c_str());
+        throw runtime_error("Can't create snapshot "s + path);
+    }
+}
+
+SnapshotWriter::~SnapshotWriter() {
+    if (!closed_) {
+        out_.close();
+        remove(temp_path_.c_str());
+    }
+}
+
+void SnapshotWriter::Write(const void* data, size_t size) {
+    out_.write(static_cast<const char*>(data), static_cast<streamsize>(size));
+}
+
+void SnapshotWriter::WriteString(string_view str) {
+    Write(static_cast<uint32_t>(str.size()));
+    Write(str.data(), str.size());
+}
+
+void SnapshotWriter::Close() {
+    out_.close();
+    // rename replaces the file atomically; its old data stays readable
+    // through existing mappings
+    if (!out_ || rename(temp_path_.c_str(), path_.c_str()) != 0) {
+        throw runtime_error("Can't write snapshot "s + path_);
+    }
+    closed_ = true;
+}
+
+SnapshotReader::SnapshotReader(shared_ptr<const MappedFile> file)
+    : file_(move(file)) {
+}
+
+const uint8_t* SnapshotReader::ReadBytes(size_t size) {
+    if (size > file_->size() - position_) {
+        throw runtime_error("Snapshot is truncated"s);
+    }
+    const uint8_t* bytes = file_->data() + position_;
+    position_ += size;
+    return bytes;
+}
+
+string_view SnapshotReader::ReadString() {
+    const uint32_t size = Read<uint32_t>();
+    return {reinterpret_cast<const char*>(ReadBytes(size)), size};
+}
+
+bool SnapshotReader::AtEnd() const {
+    return position_ == file_->size();
+}
+
+const shared_ptr<const MappedFile>& SnapshotReader::GetFile() const {
+    return file_;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Binary snapshot files: values are written in the native byte order, the
+// file header holds a byte order mark to reject foreign snapshots.
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    // Throw std::runtime_error if the file can't be mapped
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const;
+    size_t size() const;
+
+private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Writes a snapshot to a temporary file next to the path, which replaces
+// the file on Close. So a failed write keeps the old snapshot, and a snapshot
+// mapped by a loaded index is never truncated
+class SnapshotWriter {
+public:
+    // Throw std::runtime_error if the file can't be created
+    explicit SnapshotWriter(const std::string& path);
+    // Remove the temporary file unless Close succeeded
+    ~SnapshotWriter();
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    template <typename T>
+    void Write(const T& value);
+
+    void Write(const void* data, size_t size);
+    void WriteString(std::string_view str);
+
+    template <typename T>
+    void WriteVector(const std::vector<T>& values);
+
+    // Flush the file and move it to the path; throw std::runtime_error on
+    // write errors
+    void Close();
+
+private:
+    std::string path_;
+    std::string temp_path_;
+    std::ofstream out_;
+    bool closed_ = false;
+};
+
+// Reads values from a mapped snapshot, throws std::runtime_error if the
+// snapshot is truncated
+class SnapshotReader {
+public:
+    explicit SnapshotReader(std::shared_ptr<const MappedFile> file);
+
+    template <typename T>
+    T Read();
+
+    // Pointer to size bytes inside the mapping
+    const uint8_t* ReadBytes(size_t size);
+    // View of a string inside the mapping
+    std::string_view ReadString();
+
+    template <typename T>
+    std::vector<T> ReadVector();
+
+    bool AtEnd() const;
+
+    // Mapping must outlive pointers returned by ReadBytes and ReadString
+    const std::shared_ptr<const MappedFile>& GetFile() const;
+
+private:
+    std::shared_ptr<const MappedFile> file_;
+    size_t position_ = 0;
+};
+
+template <typename T>
+void SnapshotWriter::Write(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    Write(&value, sizeof(value));
+}
+
+template <typename T>
+void SnapshotWriter::WriteVector(const std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    Write(static_cast<uint64_t>(values.size()));
+    Write(values.data(), values.size() * sizeof(T));
+}
+
+template <typename T>
+T SnapshotReader::Read() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    std::memcpy(&value, ReadBytes(sizeof(value)), sizeof(value));
+    return value;
+}
+
+template <typename T>
+std::vector<T> SnapshotReader::ReadVector() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    const uint64_t size = Read<uint64_t>();
+    if (size > (file_->size() - position_) / sizeof(T)) {
+        using namespace std::literals;
+        throw std::runtime_error("Snapshot is truncated"s);
+    }
+    std::vector<T> values(size);
+    if (size > 0) {
+        std::memcpy(values.data(), ReadBytes(size * sizeof(T)), size * sizeof(T));
+    }
+    return values;
+}
@@ -0,0 +1,114 @@
+#include "stage_latency.h"
+
+#include <iomanip>
+
+using namespace std;
+
+string_view GetQueryStageName(QueryStage stage) {
+    switch (stage) {
+    case QueryStage::PARSE:
+        return "parse"sv;
+    case QueryStage::POSTING_FETCH:
+        return "posting fetch"sv;
+    case QueryStage::MINUS_FILTERING:
+        return "minus filtering"sv;
+    case QueryStage::SCORING:
+        return "scoring"sv;
+    case QueryStage::TOP_K:
+        return "top-k"sv;
+    case QueryStage::RESULT_BUILD:
+        return "result build"sv;
+    case QueryStage::FIND_TOP_DOCUMENTS:
+        return "FindTopDocuments"sv;
+    case QueryStage::MATCH_DOCUMENT:
+        return "MatchDocument"sv;
+    case QueryStage::PROCESS_QUERIES:
+        return "ProcessQueries"sv;
+    }
+    return "unknown"sv;
+}
+
+#ifdef ENABLE_STAGE_LATENCY
+void StageDurations::Record() const {
+    const uint32_t stages = stages_.load(memory_order_relaxed);
+    for (int i = 0; i < QUERY_STAGE_COUNT; ++i) {
+        if (stages & (1u << i)) {
+            StageLatencyRegistry::Instance().Record(
+                static_cast<QueryStage>(i), chrono::nanoseconds(durations_[i].load(memory_order_relaxed)));
+        }
+    }
+}
+#endif
+
+StageLatencyRegistry& StageLatencyRegistry::Instance() {
+    static StageLatencyRegistry registry;
+    return registry;
+}
+
+void StageLatencyRegistry::Record(QueryStage stage, chrono::nanoseconds latency) {
+    thread_local ThreadSlot slot(*this);
+    // the only writer of the counter: no read-modify-write is needed
+    atomic<uint64_t>& counter = slot.Get().stages[static_cast<int>(stage)][LatencyHistogram::GetBucket(latency)];
+    counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+LatencyHistogram StageLatencyRegistry::GetHistogram(QueryStage stage) const {
+    LatencyHistogram histogram;
+    lock_guard guard(mutex_);
+    for (const auto& thread_histograms : histograms_) {
+        const Counters& counters = thread_histograms->stages[static_cast<int>(stage)];
+        for (int bucket = 0; bucket < LatencyHistogram::BUCKET_COUNT; ++bucket) {
+            const uint64_t count = counters[bucket].load(memory_order_relaxed);
+            if (count > 0) {
+                histogram.AddBucketCount(bucket, count);
+            }
+        }
+    }
+    return histogram;
+}
+
+void StageLatencyRegistry::Reset() {
+    lock_guard guard(mutex_);
+    for (const auto& thread_histograms : histograms_) {
+        for (Counters& counters : thread_histograms->stages) {
+            for (atomic<uint64_t>& counter : counters) {
+                counter.store(0, memory_order_relaxed);
+            }
+        }
+    }
+}
+
+void StageLatencyRegistry::Dump(ostream& output) const {
+    const auto to_microseconds = [](chrono::nanoseconds latency) {
+        return chrono::duration<double, micro>(latency).count();
+    };
+    for (int i = 0; i < QUERY_STAGE_COUNT; ++i) {
+        const QueryStage stage = static_cast<QueryStage>(i);
+        const LatencyHistogram histogram = GetHistogram(stage);
+        if (histogram.GetCount() == 0) {
+            continue;
+        }
+        output << GetQueryStageName(stage) << ": count "s << histogram.GetCount()
+               << fixed << setprecision(1)
+               << ", p50 "s << to_microseconds(histogram.GetQuantile(0.5))
+               << " us, p99 "s << to_microseconds(histogram.GetQuantile(0.99))
+               << " us, p999 "s << to_microseconds(histogram.GetQuantile(0.999)) << " us"s << endl;
+    }
+}
+
+StageLatencyRegistry::ThreadSlot::ThreadSlot(StageLatencyRegistry& registry)
+    : registry_(registry) {
+    lock_guard guard(registry_.mutex_);
+    if (registry_.free_histograms_.empty()) {
+        registry_.histograms_.push_back(make_unique<ThreadHistograms>());
+        histograms_ = registry_.histograms_.back().get();
+    } else {
+        histograms_ = registry_.free_histograms_.back();
+        registry_.free_histograms_.pop_back();
+    }
+}
+
+StageLatencyRegistry::ThreadSlot::~ThreadSlot() {
+    lock_guard guard(registry_.mutex_);
+    registry_.free_histograms_.push_back(histograms_);
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "latency_histogram.h"
+
+// Latency of the stages of query processing. Every thread records into
+// histograms of its own, so recording takes no locks: a clock reading and a
+// counter increment. Histograms of all threads are merged when they are read.
+//
+// The macros compile to nothing unless ENABLE_STAGE_LATENCY is defined:
+//
+//  void Search() {
+//      STAGE_LATENCY_SCOPE(timer, QueryStage::PARSE);
+//      ...                                            // parse
+//      STAGE_LATENCY_NEXT(timer, QueryStage::SCORING);
+//      ...                                            // score
+//  }                                                  // recorded here
+//
+// A stage split into parts (stripes of a parallel search) is summed into
+// StageDurations of the request and recorded once, so there is a sample per
+// request and stage; summed time of parallel parts may exceed wall time.
+// Term lookups of a query batch are shared, so they are a sample per batch.
+
+enum class QueryStage {
+    PARSE,
+    POSTING_FETCH,
+    MINUS_FILTERING,
+    SCORING,
+    TOP_K,
+    RESULT_BUILD,
+    // whole requests
+    FIND_TOP_DOCUMENTS,
+    MATCH_DOCUMENT,
+    PROCESS_QUERIES,
+};
+
+inline constexpr int QUERY_STAGE_COUNT = static_cast<int>(QueryStage::PROCESS_QUERIES) + 1;
+
+std::string_view GetQueryStageName(QueryStage stage);
+
+class StageLatencyRegistry {
+public:
+    static StageLatencyRegistry& Instance();
+
+    void Record(QueryStage stage, std::chrono::nanoseconds latency);
+
+    // histogram of the stage merged from all threads
+    LatencyHistogram GetHistogram(QueryStage stage) const;
+
+    // Forget the recorded values; values recorded concurrently may be kept
+    void Reset();
+
+    // a line per stage with records: name, count, p50, p99 and p999 in
+    // microseconds
+    void Dump(std::ostream& output) const;
+
+private:
+    using Counters = std::array<std::atomic<uint64_t>, LatencyHistogram::BUCKET_COUNT>;
+
+    // Histograms of a thread; they are written by the thread only and go to
+    // a free list when it exits, so records of finished threads are kept
+    struct ThreadHistograms {
+        std::array<Counters, QUERY_STAGE_COUNT> stages{};
+    };
+
+    // returns the histograms of the thread to the free list on its exit
+    class ThreadSlot {
+    public:
+        explicit ThreadSlot(StageLatencyRegistry& registry);
+        ~ThreadSlot();
+
+        ThreadHistograms& Get() {
+            return *histograms_;
+        }
+
+    private:
+        StageLatencyRegistry& registry_;
+        ThreadHistograms* histograms_;
+    };
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<ThreadHistograms>> histograms_;
+    std::vector<ThreadHistograms*> free_histograms_;
+
+    StageLatencyRegistry() = default;
+};
+
+#ifdef ENABLE_STAGE_LATENCY
+
+// Durations of the stages of a request summed over its parts, which may run
+// in parallel; Record adds a sample per stage which has parts
+class StageDurations {
+public:
+    StageDurations() = default;
+    StageDurations(const StageDurations&) = delete;
+    StageDurations& operator=(const StageDurations&) = delete;
+
+    void Add(QueryStage stage, std::chrono::nanoseconds duration) {
+        durations_[static_cast<int>(stage)].fetch_add(duration.count(), std::memory_order_relaxed);
+        stages_.fetch_or(1u << static_cast<int>(stage), std::memory_order_relaxed);
+    }
+
+    void Record() const;
+
+private:
+    std::array<std::atomic<std::chrono::nanoseconds::rep>, QUERY_STAGE_COUNT> durations_{};
+    std::atomic<uint32_t> stages_ = 0;
+};
+
+#else
+
+class StageDurations {
+public:
+    void Add(QueryStage, std::chrono::nanoseconds) {
+    }
+
+    void Record() const {
+    }
+};
+
+#endif
+
+// Records time from construction or the last Next to the next Next or
+// destruction as the current stage, into the registry or into durations
+class StageTimer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit StageTimer(QueryStage stage, StageDurations* durations = nullptr)
+        : stage_(stage)
+        , durations_(durations)
+        , start_(Clock::now()) {
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    ~StageTimer() {
+        Add(Clock::now() - start_);
+    }
+
+    void Next(QueryStage stage) {
+        const Clock::time_point now = Clock::now();
+        Add(now - start_);
+        stage_ = stage;
+        start_ = now;
+    }
+
+private:
+    QueryStage stage_;
+    StageDurations* durations_;
+    Clock::time_point start_;
+
+    void Add(std::chrono::nanoseconds duration) {
+        if (durations_) {
+            durations_->Add(stage_, duration);
+        } else {
+            StageLatencyRegistry::Instance().Record(stage_, duration);
+        }
+    }
+};
+
+#ifdef ENABLE_STAGE_LATENCY
+#define STAGE_LATENCY_SCOPE(timer, stage) StageTimer timer(stage)
+#define STAGE_LATENCY_PART(timer, stage, durations) StageTimer timer(stage, &(durations))
+#define STAGE_LATENCY_NEXT(timer, stage) timer.Next(stage)
+#else
+#define STAGE_LATENCY_SCOPE(timer, stage)
+#define STAGE_LATENCY_PART(timer, stage, durations)
+#define STAGE_LATENCY_NEXT(timer, stage)
+#endif
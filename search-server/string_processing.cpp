@@ -1,20 +1,142 @@
 #include "string_processing.h"
 
-#include <algorithm>
+#include <cstdint>
 #include <utility>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
-vector<string> SplitIntoWords(const string_view text) {
-    if (text.empty())
-        return {};
-    vector<string> words;
+namespace {
+
+constexpr size_t BLOCK_SIZE = 32;
+constexpr size_t NO_WORD = static_cast<size_t>(-1);
+
+bool IsControlCharacter(char c) {
+    return c >= '\0' && c < ' ';
+}
+
+// Bit i of spaces is set if block[i] is a space, bit i of controls is set if
+// block[i] is a control character
+void ClassifyBlock(const char* block, uint32_t& spaces, uint32_t& controls) {
+#if defined(__AVX2__)
+    const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+    spaces = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '))));
+    // bytes are compared as signed: bytes from 0x80 are negative, not controls
+    const __m256i controls_mask = _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(' '), bytes),
+                                                   _mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(-1)));
+    controls = static_cast<uint32_t>(_mm256_movemask_epi8(controls_mask));
+#elif defined(__SSE2__)
+    spaces = 0;
+    controls = 0;
+    for (size_t half = 0; half < 2; ++half) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + half * 16));
+        const uint32_t half_spaces = static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '))));
+        // bytes are compared as signed: bytes from 0x80 are negative, not controls
+        const __m128i controls_mask = _mm_and_si128(_mm_cmplt_epi8(bytes, _mm_set1_epi8(' ')),
+                                                    _mm_cmpgt_epi8(bytes, _mm_set1_epi8(-1)));
+        const uint32_t half_controls = static_cast<uint32_t>(_mm_movemask_epi8(controls_mask));
+        spaces |= half_spaces << (half * 16);
+        controls |= half_controls << (half * 16);
+    }
+#else
+    spaces = 0;
+    controls = 0;
+    for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+        spaces |= static_cast<uint32_t>(block[i] == ' ') << i;
+        controls |= static_cast<uint32_t>(IsControlCharacter(block[i])) << i;
+    }
+#endif
+}
 
-    auto i1 = find_if(text.begin(), text.end(), [](char c) {return c != ' ';});
-    while (i1 != text.end()) {
-        auto i2 = find(i1, text.end(), ' ');
-        words.emplace_back(i1, i2);
-        i1 = find_if(i2, text.end(), [](char c) {return c != ' ';});
+int CountTrailingZeros(uint32_t value) {
+#if defined(__GNUC__)
+    return __builtin_ctz(value);
+#else
+    int count = 0;
+    for (; (value & 1) == 0; value >>= 1) {
+        ++count;
     }
+    return count;
+#endif
+}
+
+} // namespace
+
+vector<string> SplitIntoWords(const string_view text) {
+    const vector<string_view> views = SplitIntoWordsView(text);
+    return {views.begin(), views.end()};
+}
+
+vector<string_view> SplitIntoWordsView(const string_view text) {
+    vector<string_view> words;
+    SplitIntoWordsView(text, words);
     return words;
 }
+
+bool SplitIntoWordsView(const string_view text, vector<string_view>& words) {
+    const char* const data = text.data();
+    const size_t size = text.size();
+    uint32_t controls = 0;
+    // start of the current word
+    size_t word_begin = NO_WORD;
+    size_t position = 0;
+    for (; position + BLOCK_SIZE <= size; position += BLOCK_SIZE) {
+        uint32_t block_spaces;
+        uint32_t block_controls;
+        ClassifyBlock(data + position, block_spaces, block_controls);
+        controls |= block_controls;
+        // a bit is set where a byte differs from the previous one in being
+        // a space, i.e. at word starts and word ends
+        const uint32_t previous_spaces = (block_spaces << 1) | (word_begin == NO_WORD ? 1u : 0u);
+        for (uint32_t boundaries = block_spaces ^ previous_spaces; boundaries != 0;
+             boundaries &= boundaries - 1) {
+            const size_t boundary = position + CountTrailingZeros(boundaries);
+            if (word_begin == NO_WORD) {
+                word_begin = boundary;
+            } else {
+                words.emplace_back(data + word_begin, boundary - word_begin);
+                word_begin = NO_WORD;
+            }
+        }
+    }
+    for (; position < size; ++position) {
+        const char c = data[position];
+        controls |= IsControlCharacter(c);
+        if (c != ' ') {
+            if (word_begin == NO_WORD) {
+                word_begin = position;
+            }
+        } else if (word_begin != NO_WORD) {
+            words.emplace_back(data + word_begin, position - word_begin);
+            word_begin = NO_WORD;
+        }
+    }
+    if (word_begin != NO_WORD) {
+        words.emplace_back(data + word_begin, size - word_begin);
+    }
+    return controls == 0;
+}
+
+bool HasControlCharacters(const string_view text) {
+    size_t position = 0;
+    for (; position + BLOCK_SIZE <= text.size(); position += BLOCK_SIZE) {
+        uint32_t spaces;
+        uint32_t controls;
+        ClassifyBlock(text.data() + position, spaces, controls);
+        if (controls != 0) {
+            return true;
+        }
+    }
+    for (; position < text.size(); ++position) {
+        if (IsControlCharacter(text[position])) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -4,4 +4,18 @@
 #include <string_view>
 #include <vector>
 
+// Words are separated by spaces. Control characters (codes 0-31) are invalid
+// in words. Text is scanned in blocks with SSE2 or AVX2 when the target
+// supports them, with a scalar fallback otherwise.
+
 std::vector<std::string> SplitIntoWords(const std::string_view text);
+
+// Views of the words of text, valid while the text is alive
+std::vector<std::string_view> SplitIntoWordsView(const std::string_view text);
+
+// Append views of the words of text to words. Boundaries and invalid
+// characters are found in one pass; return false if text contains a control
+// character (words are split anyway)
+bool SplitIntoWordsView(const std::string_view text, std::vector<std::string_view>& words);
+
+bool HasControlCharacters(const std::string_view text);
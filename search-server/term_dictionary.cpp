@@ -0,0 +1,72 @@
+#include "term_dictionary.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+using namespace std;
+
+TermDictionary::TermId TermDictionary::Find(string_view term) const {
+    if (slots_.empty()) {
+        return NO_TERM;
+    }
+    return slots_[FindSlot(term, hash<string_view>{}(term))];
+}
+
+TermDictionary::TermId TermDictionary::Insert(string_view term) {
+    const size_t term_hash = hash<string_view>{}(term);
+    if (!slots_.empty()) {
+        const TermId id = slots_[FindSlot(term, term_hash)];
+        if (id != NO_TERM) {
+            return id;
+        }
+    }
+    // load factor is kept not greater than 1/2
+    if ((terms_.size() + 1) * 2 > slots_.size()) {
+        Rehash(max<size_t>(16, slots_.size() * 2));
+    }
+    const TermId id = static_cast<TermId>(terms_.size());
+    terms_.push_back(Store(term));
+    hashes_.push_back(term_hash);
+    slots_[FindSlot(term, term_hash)] = id;
+    return id;
+}
+
+size_t TermDictionary::FindSlot(string_view term, size_t hash) const {
+    const size_t mask = slots_.size() - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        const TermId id = slots_[slot];
+        if (id == NO_TERM || (hashes_[id] == hash && terms_[id] == term)) {
+            return slot;
+        }
+    }
+}
+
+void TermDictionary::Rehash(size_t slot_count) {
+    slots_.assign(slot_count, NO_TERM);
+    const size_t mask = slot_count - 1;
+    for (TermId id = 0; id < terms_.size(); ++id) {
+        size_t slot = hashes_[id] & mask;
+        while (slots_[slot] != NO_TERM) {
+            slot = (slot + 1) & mask;
+        }
+        slots_[slot] = id;
+    }
+}
+
+string_view TermDictionary::Store(string_view term) {
+    if (term.size() > chunk_free_) {
+        // long terms get chunks of their own
+        const size_t chunk_size = max(CHUNK_SIZE, term.size());
+        chunks_.push_back(make_unique<char[]>(chunk_size));
+        chunk_position_ = chunks_.back().get();
+        chunk_free_ = chunk_size;
+    }
+    char* data = chunk_position_;
+    if (!term.empty()) {
+        memcpy(data, term.data(), term.size());
+    }
+    chunk_position_ += term.size();
+    chunk_free_ -= term.size();
+    return {data, term.size()};
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib> // size_t
+#include <limits>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Interned terms with dense 32-bit ids. Term text is kept in an arena of
+// chunks which are never moved, so views of terms are valid while the
+// dictionary lives (moving the dictionary keeps them valid too). Terms are
+// found by an open addressing hash table with linear probing. Terms are
+// never removed, so ids are stable.
+class TermDictionary {
+public:
+    using TermId = uint32_t;
+    static constexpr TermId NO_TERM = std::numeric_limits<TermId>::max();
+
+    // Id of the term or NO_TERM
+    TermId Find(std::string_view term) const;
+
+    // Id of the term; a new term gets the next id
+    TermId Insert(std::string_view term);
+
+    std::string_view GetTerm(TermId id) const {
+        return terms_[id];
+    }
+
+    size_t size() const {
+        return terms_.size();
+    }
+
+private:
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    // free bytes at the end of the last chunk
+    char* chunk_position_ = nullptr;
+    size_t chunk_free_ = 0;
+    std::vector<std::string_view> terms_;
+    std::vector<size_t> hashes_;
+    // term ids, NO_TERM in empty slots; size is a power of two
+    std::vector<TermId> slots_;
+
+    // Slot of the term or the empty slot where it would be
+    size_t FindSlot(std::string_view term, size_t hash) const;
+    void Rehash(size_t slot_count);
+    // Copy term into the arena
+    std::string_view Store(std::string_view term);
+};
@@ -1,11 +1,27 @@
 #include "testing.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <execution>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <sstream>
 #include <string>
+#include <thread>
 
+#include "latency_histogram.h"
+#include "process_queries.h"
+#include "remove_duplicates.h"
+#include "request_queue.h"
+#include "search_index.h"
 #include "search_server.h"
+#include "stage_latency.h"
+#include "string_processing.h"
+#include "term_dictionary.h"
 
 using namespace std;
 
@@ -166,6 +182,54 @@ void TestMinusWords() {
     }
 }
 
+void TestMinusWordsExclusion() {
+    // several stripes of ordinals, removed documents are kept as tombstones
+    SearchIndex index;
+    const int document_count = 10000;
+    const auto has_word = [](int id, int word) {
+        return id % (word + 2) == 0;
+    };
+    for (int id = 0; id < document_count; ++id) {
+        string text = "all"s;
+        for (int word = 0; word < 10; ++word) {
+            if (has_word(id, word)) {
+                text += " w"s + to_string(word);
+            }
+        }
+        index.AddDocument(id, text, DocumentStatus::ACTUAL, {1});
+    }
+    for (int id = 0; id < document_count; id += 7) {
+        index.RemoveDocument(id);
+    }
+
+    const auto check = [&](const string& query, int plus_word, const vector<int>& minus_words) {
+        set<int> expected;
+        for (int id = 0; id < document_count; ++id) {
+            if (id % 7 == 0 || (plus_word >= 0 && !has_word(id, plus_word))) {
+                continue;
+            }
+            if (none_of(minus_words.begin(), minus_words.end(), [&](int word) { return has_word(id, word); })) {
+                expected.insert(id);
+            }
+        }
+        for (const auto& docs : {
+                index.FindTopDocuments(execution::seq, query, DocumentStatus::ACTUAL, 0, document_count),
+                index.FindTopDocuments(execution::par, query, DocumentStatus::ACTUAL, 0, document_count)}) {
+            set<int> ids;
+            for (const Document& document : docs) {
+                ids.insert(document.id);
+            }
+            ASSERT_HINT(ids == expected, query);
+        }
+    };
+    check("all"s, -1, {});
+    check("all -w0"s, -1, {0});
+    check("all -w0 -w1 -w8"s, -1, {0, 1, 8});
+    check("w3 -w0"s, 3, {0});
+    // every document has "all"
+    check("w1 -all"s, 1, {1});
+}
+
 void TestMatchDocument2() {
     int doc_id = 13;
     SearchServer server("a and not"s);
@@ -185,6 +249,92 @@ void TestMatchDocument2() {
     }
 }
 
+void TestMatchDocuments() {
+    SearchServer server("and with"s);
+    // documents from 1 to 500 words, words of a query from 1 to 40
+    const auto has_word = [](int id, int word) {
+        return word % (id % 7 + 1) == 0 && word <= id;
+    };
+    vector<int> ids;
+    for (int id = 1; id <= 500; id += 3) {
+        string text = "and"s;
+        for (int word = 0; word < 1000; ++word) {
+            if (has_word(id, word)) {
+                text += " w"s + to_string(word);
+            }
+        }
+        server.AddDocument(id, text, static_cast<DocumentStatus>(id % 4), {1});
+        ids.push_back(id);
+    }
+
+    const auto expected_words = [&has_word](int id, const vector<int>& plus_words, const vector<int>& minus_words) {
+        vector<string> words;
+        for (const int word : minus_words) {
+            if (has_word(id, word)) {
+                return words;
+            }
+        }
+        for (const int word : plus_words) {
+            if (has_word(id, word)) {
+                words.push_back("w"s + to_string(word));
+            }
+        }
+        sort(words.begin(), words.end());
+        return words;
+    };
+    const auto check = [&](const vector<int>& plus_words, const vector<int>& minus_words) {
+        string query = "and unknown"s;
+        for (const int word : plus_words) {
+            query += " w"s + to_string(word);
+        }
+        for (const int word : minus_words) {
+            query += " -w"s + to_string(word);
+        }
+        const auto results = server.MatchDocuments(query, ids);
+        const auto par_results = server.MatchDocuments(execution::par, query, ids);
+        ASSERT_EQUAL(results.size(), ids.size());
+        ASSERT_EQUAL(par_results.size(), ids.size());
+        for (size_t i = 0; i < ids.size(); ++i) {
+            const vector<string> expected = expected_words(ids[i], plus_words, minus_words);
+            const auto [words, status] = server.MatchDocument(query, ids[i]);
+            ASSERT_HINT(vector<string>(words.begin(), words.end()) == expected, query);
+            ASSERT(status == static_cast<DocumentStatus>(ids[i] % 4));
+            ASSERT(get<0>(results[i]) == words && get<1>(results[i]) == status);
+            ASSERT(get<0>(par_results[i]) == words && get<1>(par_results[i]) == status);
+            ASSERT(get<0>(server.MatchDocument(execution::par, query, ids[i])) == words);
+        }
+    };
+    check({}, {});
+    check({3}, {});
+    check({1, 2, 3, 4, 5, 6, 7, 8, 9, 10}, {});
+    check({0, 12, 499, 997}, {13});
+    vector<int> long_query;
+    for (int word = 0; word < 1000; word += 25) {
+        long_query.push_back(word);
+    }
+    check(long_query, {});
+    check(long_query, {5, 300});
+    // queries matched by several parallel tasks
+    vector<int> longer_query;
+    for (int word = 0; word < 1000; word += 3) {
+        longer_query.push_back(word);
+    }
+    check(longer_query, {});
+    check(longer_query, {1});
+    check(longer_query, long_query);
+
+    try {
+        server.MatchDocuments("w1"s, vector<int>{1, 2});
+        ASSERT_HINT(false, "unknown document must throw"s);
+    } catch (const out_of_range&) {
+    }
+    try {
+        server.MatchDocuments("w1 --w2"s, ids);
+        ASSERT_HINT(false, "invalid query must throw"s);
+    } catch (const invalid_argument&) {
+    }
+}
+
 void TestRelevanceSort() {
     SearchServer server("a and not"s);
     server.AddDocument(1, "not xxx one and xxx two three four five yyy"s, DocumentStatus::ACTUAL, {1,2,3});
@@ -312,17 +462,1063 @@ void TestRelevanceValue() {
     }
 }
 
+void TestSparseDocumentIds() {
+    SearchServer server;
+    server.AddDocument(1'000'000, "xxx one"s, DocumentStatus::ACTUAL, {1});
+    server.AddDocument(3, "xxx two"s, DocumentStatus::BANNED, {2});
+    server.AddDocument(500, "xxx three"s, DocumentStatus::ACTUAL, {3});
+    ASSERT_EQUAL(server.GetDocumentCount(), 3);
+    {
+        auto docs = server.FindTopDocuments("xxx one"s);
+        ASSERT_EQUAL(docs.size(), 2u);
+        ASSERT_EQUAL(docs[0].id, 1'000'000);
+        ASSERT_EQUAL(docs[0].rating, 1);
+        ASSERT_EQUAL(docs[1].id, 500);
+        ASSERT_EQUAL(docs[1].rating, 3);
+    }
+    {
+        auto docs = server.FindTopDocuments("two"s, DocumentStatus::BANNED);
+        ASSERT_EQUAL(docs.size(), 1u);
+        ASSERT_EQUAL(docs[0].id, 3);
+    }
+    server.RemoveDocument(1'000'000);
+    ASSERT_EQUAL(server.GetDocumentCount(), 2);
+    ASSERT(server.FindTopDocuments("one"s).empty());
+    // the same id can be added again after removing
+    server.AddDocument(1'000'000, "yyy"s, DocumentStatus::ACTUAL, {4});
+    {
+        auto docs = server.FindTopDocuments("yyy xxx"s);
+        ASSERT_EQUAL(docs.size(), 2u);
+        ASSERT_EQUAL(docs[0].id, 1'000'000);
+        ASSERT_EQUAL(docs[0].rating, 4);
+        auto match = server.MatchDocument("one yyy"s, 1'000'000);
+        ASSERT_EQUAL(get<0>(match).size(), 1u);
+        ASSERT_EQUAL(get<0>(match).at(0), "yyy"s);
+    }
+}
+
+void TestParallelFindTopDocuments() {
+    SearchServer server("and"s);
+    // enough documents to be split between several parallel tasks
+    const int doc_count = 10'000;
+    for (int id = 0; id < doc_count; ++id) {
+        const string content = "w"s + to_string(id % 7) + " w"s + to_string(id % 13)
+            + " and w"s + to_string(id % 101) + " w"s + to_string(id % 7);
+        // distinct ratings make the order of the documents unique
+        server.AddDocument(id, content, DocumentStatus::ACTUAL, {id});
+    }
+    for (const string& query : {"w1"s, "w3 w5 w12"s, "w0 w1 w2 -w3"s, "w100 -w4 -w5"s, "and"s}) {
+        const auto seq_docs = server.FindTopDocuments(execution::seq, query);
+        const auto par_docs = server.FindTopDocuments(execution::par, query);
+        ASSERT_EQUAL_HINT(seq_docs.size(), par_docs.size(), query);
+        for (size_t i = 0; i < seq_docs.size(); ++i) {
+            ASSERT_EQUAL_HINT(seq_docs[i].id, par_docs[i].id, query);
+            ASSERT_HINT(abs(seq_docs[i].relevance - par_docs[i].relevance) < RELEVANCE_EPS, query);
+        }
+    }
+}
+
+void TestFindTopDocumentsWindow() {
+    SearchServer server;
+    const int doc_count = 100;
+    for (int id = 0; id < doc_count; ++id) {
+        server.AddDocument(id, "xxx"s + (id % 2 ? " yyy"s : ""s), DocumentStatus::ACTUAL, {id});
+    }
+    const auto all_docs = server.FindTopDocuments("xxx"s, DocumentStatus::ACTUAL, 0, doc_count);
+    ASSERT_EQUAL(all_docs.size(), static_cast<size_t>(doc_count));
+    ASSERT_EQUAL(server.FindTopDocuments("xxx"s).size(), static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT));
+    {
+        const auto docs = server.FindTopDocuments("xxx"s, DocumentStatus::ACTUAL, 50, 10);
+        ASSERT_EQUAL(docs.size(), 10u);
+        for (size_t i = 0; i < docs.size(); ++i) {
+            ASSERT_EQUAL(docs[i].id, all_docs[50 + i].id);
+        }
+    }
+    {
+        const auto docs = server.FindTopDocuments(execution::par, "xxx"s, DocumentStatus::ACTUAL, 95, 10);
+        ASSERT_EQUAL(docs.size(), 5u);
+        for (size_t i = 0; i < docs.size(); ++i) {
+            ASSERT_EQUAL(docs[i].id, all_docs[95 + i].id);
+        }
+    }
+    ASSERT(server.FindTopDocuments("xxx"s, DocumentStatus::ACTUAL, doc_count, 10).empty());
+    ASSERT(server.FindTopDocuments("xxx"s, DocumentStatus::ACTUAL, 0, 0).empty());
+    {
+        const auto docs = server.FindTopDocuments("xxx"s, [](int id, DocumentStatus st, int rating) {
+                (void)st;
+                (void)rating;
+                return id % 2 == 0;}, 1, 2);
+        ASSERT_EQUAL(docs.size(), 2u);
+        ASSERT_EQUAL(docs[0].id, 96);
+        ASSERT_EQUAL(docs[1].id, 94);
+    }
+}
+
+void TestTopDocumentsPruning() {
+    SearchServer server;
+    // skewed word frequencies: word wN is in every N-th document
+    const int doc_count = 2'000;
+    for (int id = 0; id < doc_count; ++id) {
+        string content;
+        for (int n = 1; n <= 64; n *= 2) {
+            if (id % n == 0) {
+                content += " w"s + to_string(n);
+            }
+        }
+        server.AddDocument(id, content, DocumentStatus::ACTUAL, {id});
+    }
+    for (const string& query : {"w1 w2 w64"s, "w1 w2 w4 w8 w16 w32 w64"s, "w1 w64 -w32"s}) {
+        // the window of all documents is computed without pruning
+        const auto all_docs = server.FindTopDocuments(query, DocumentStatus::ACTUAL, 0, doc_count);
+        const auto docs = server.FindTopDocuments(query);
+        ASSERT_EQUAL_HINT(docs.size(), static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT), query);
+        for (size_t i = 0; i < docs.size(); ++i) {
+            ASSERT_EQUAL_HINT(docs[i].id, all_docs[i].id, query);
+        }
+    }
+
+    // scores of a query interrupted by its predicate don't leak to the next
+    // query of the thread
+    const auto expected = server.FindTopDocuments("w1 w64"s);
+    try {
+        server.FindTopDocuments("w1 w64"s, [](int document_id, DocumentStatus, int) {
+            if (document_id == 1'024) {
+                throw runtime_error("stop"s);
+            }
+            return true;
+        });
+        ASSERT_HINT(false, "exception of the predicate must be thrown"s);
+    } catch (const runtime_error&) {
+    }
+    const auto docs = server.FindTopDocuments("w1 w64"s);
+    ASSERT_EQUAL(docs.size(), expected.size());
+    for (size_t i = 0; i < docs.size(); ++i) {
+        ASSERT_EQUAL(docs[i].id, expected[i].id);
+        ASSERT(abs(docs[i].relevance - expected[i].relevance) < RELEVANCE_EPS);
+    }
+}
+
+void TestCompressedPostings() {
+    SearchIndex index;
+    // long posting lists of several blocks, repeated words give term counts
+    const int doc_count = 1'000;
+    for (int id = 0; id < doc_count; ++id) {
+        string content = "common"s;
+        for (int i = 0; i < id % 3; ++i) {
+            content += " tri"s;
+        }
+        index.AddDocument(id * 7, content, DocumentStatus::ACTUAL, {id});
+    }
+    // removed documents are skipped by the tombstones, then compaction
+    // packs the rest into new blocks and a tail
+    for (int id = 0; id < doc_count; id += 5) {
+        index.RemoveDocument(id * 7);
+    }
+
+    const int tri_count = 533; // id % 3 != 0 && id % 5 != 0
+    const auto check = [&index, doc_count, tri_count]() {
+        ASSERT_EQUAL(index.GetDocumentCount(), doc_count - doc_count / 5);
+        for (int id = 1; id < doc_count; ++id) {
+            if (id % 5 == 0) {
+                continue;
+            }
+            const auto [words, status] = index.MatchDocument("tri"s, id * 7);
+            ASSERT_EQUAL_HINT(words.size(), static_cast<size_t>(id % 3 != 0), to_string(id));
+        }
+        const auto docs = index.FindTopDocuments("tri"s, DocumentStatus::ACTUAL, 0, doc_count);
+        ASSERT_EQUAL(docs.size(), static_cast<size_t>(tri_count));
+        // "common tri tri": term frequency is 2/3
+        const double idf = log((doc_count - doc_count / 5) * 1.0 / tri_count);
+        ASSERT(abs(docs.front().relevance - 2.0 / 3 * idf) < RELEVANCE_EPS);
+        ASSERT(abs(docs.back().relevance - 1.0 / 2 * idf) < RELEVANCE_EPS);
+    };
+    check();
+    index.Compact();
+    check();
+}
+
+void TestSnapshot() {
+    SearchServer server("and in on"s);
+    for (int id = 0; id < 500; ++id) {
+        const string content = "cat in the city"s + (id % 2 ? " dog"s : " big cat"s)
+            + " w"s + to_string(id % 7);
+        server.AddDocument(id * 3, content, static_cast<DocumentStatus>(id % 4), {id, 1});
+    }
+    server.RemoveDocument(6);
+    const string path = (filesystem::temp_directory_path() / "search_server_test.snapshot"s).string();
+    server.SaveSnapshot(path);
+    SearchServer loaded = SearchServer::LoadSnapshot(path);
+    // saving over the mapped snapshot keeps the loaded index readable
+    loaded.SaveSnapshot(path);
+    SearchServer reloaded = SearchServer::LoadSnapshot(path);
+    filesystem::remove(path);
+
+    ASSERT_EQUAL(loaded.GetDocumentCount(), server.GetDocumentCount());
+    ASSERT_EQUAL(reloaded.GetDocumentCount(), server.GetDocumentCount());
+    ASSERT(loaded.GetDocumentIds() == server.GetDocumentIds());
+    for (const string& query : {"cat"s, "dog -w3 in"s, "big city w5"s}) {
+        for (const auto status : {DocumentStatus::ACTUAL, DocumentStatus::BANNED}) {
+            const auto expected = server.FindTopDocuments(query, status, 0, 1000);
+            for (const SearchServer* snapshot_server : {&loaded, &reloaded}) {
+                const auto docs = snapshot_server->FindTopDocuments(query, status, 0, 1000);
+                ASSERT_EQUAL_HINT(docs.size(), expected.size(), query);
+                for (size_t i = 0; i < docs.size(); ++i) {
+                    ASSERT_EQUAL_HINT(docs[i].id, expected[i].id, query);
+                    ASSERT_EQUAL_HINT(docs[i].rating, expected[i].rating, query);
+                    ASSERT_HINT(abs(docs[i].relevance - expected[i].relevance) < RELEVANCE_EPS, query);
+                }
+            }
+        }
+    }
+    ASSERT(loaded.GetWordFrequencies(9) == server.GetWordFrequencies(9));
+    ASSERT(get<0>(loaded.MatchDocument("in city"s, 9)) == vector<string_view>{"city"sv});
+
+    // the loaded index remains changeable
+    loaded.RemoveDocument(9);
+    for (int id = 2'000; id < 2'200; ++id) {
+        loaded.AddDocument(id, "dog city"s, DocumentStatus::ACTUAL, {});
+    }
+    ASSERT_EQUAL(loaded.GetDocumentCount(), server.GetDocumentCount() + 199);
+    ASSERT_EQUAL(loaded.FindTopDocuments("dog"s, DocumentStatus::ACTUAL, 0, 1000).size(), 200u);
+
+    try {
+        SearchServer::LoadSnapshot(path);
+        ASSERT_HINT(false, "missing snapshot must not be loaded"s);
+    } catch (const runtime_error&) {
+    }
+}
+
+// Corrupted snapshots are rejected or loaded, but never read out of bounds
+void TestSnapshotCorruption() {
+    SearchServer server("and in on"s);
+    for (int id = 0; id < 300; ++id) {
+        server.AddDocument(id, "cat city w"s + to_string(id % 5) + (id % 3 ? " dog"s : ""s),
+                           DocumentStatus::ACTUAL, {id});
+    }
+    const string path = (filesystem::temp_directory_path() / "search_server_test.snapshot"s).string();
+    server.SaveSnapshot(path);
+    string bytes;
+    {
+        ifstream in(path, ios::binary);
+        bytes.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    const auto load = [&path](const string& snapshot) {
+        ofstream(path, ios::binary | ios::trunc) << snapshot;
+        try {
+            const SearchIndex index = SearchIndex::LoadSnapshot(path);
+            index.FindTopDocuments("cat dog -w2"s);
+            return true;
+        } catch (const runtime_error&) {
+            return false;
+        }
+    };
+    ASSERT(load(bytes));
+
+    // every 4-byte window set to a large value
+    int rejected = 0;
+    for (size_t pos = 0; pos + 4 <= bytes.size(); ++pos) {
+        string corrupted = bytes;
+        corrupted.replace(pos, 4, "\xff\xff\xff\x7f"s);
+        rejected += !load(corrupted);
+    }
+    ASSERT(rejected > 0);
+    ASSERT(!load(bytes.substr(0, bytes.size() / 2)));
+
+    // byte order mark has its own message
+    string foreign = bytes;
+    reverse(foreign.begin() + 12, foreign.begin() + 16);
+    ofstream(path, ios::binary | ios::trunc) << foreign;
+    try {
+        SearchIndex::LoadSnapshot(path);
+        ASSERT_HINT(false, "snapshot of another byte order must not be loaded"s);
+    } catch (const runtime_error& e) {
+        ASSERT(string(e.what()).find("byte order"s) != string::npos);
+    }
+    filesystem::remove(path);
+}
+
+void TestAddDocuments() {
+    const string stop_words = "and in on"s;
+    vector<tuple<int, string, DocumentStatus, vector<int>>> documents;
+    for (int id = 0; id < 300; ++id) {
+        documents.emplace_back(id * 2, "cat in the city w"s + to_string(id % 11) + (id % 3 ? " dog dog"s : ""s),
+                               static_cast<DocumentStatus>(id % 2), vector<int>{id, 2});
+    }
+    SearchServer expected(stop_words);
+    for (const auto& [id, text, status, ratings] : documents) {
+        expected.AddDocument(id, text, status, ratings);
+    }
+
+    SearchServer seq_server(stop_words);
+    seq_server.AddDocuments(vector(documents.begin(), documents.begin() + 100));
+    seq_server.AddDocuments(execution::seq, vector(documents.begin() + 100, documents.begin() + 150));
+    SearchServer par_server(stop_words);
+    par_server.AddDocuments(execution::par, documents);
+    seq_server.AddDocuments(execution::par, vector(documents.begin() + 150, documents.end()));
+
+    for (const SearchServer* server : {&seq_server, &par_server}) {
+        ASSERT_EQUAL(server->GetDocumentCount(), expected.GetDocumentCount());
+        for (const string& query : {"cat"s, "dog -w3 in"s, "city w5 w7"s}) {
+            const auto expected_docs = expected.FindTopDocuments(query, DocumentStatus::ACTUAL, 0, 1000);
+            const auto docs = server->FindTopDocuments(query, DocumentStatus::ACTUAL, 0, 1000);
+            ASSERT_EQUAL_HINT(docs.size(), expected_docs.size(), query);
+            for (size_t i = 0; i < docs.size(); ++i) {
+                ASSERT_EQUAL_HINT(docs[i].id, expected_docs[i].id, query);
+                ASSERT_EQUAL_HINT(docs[i].rating, expected_docs[i].rating, query);
+                ASSERT_HINT(abs(docs[i].relevance - expected_docs[i].relevance) < RELEVANCE_EPS, query);
+            }
+        }
+        ASSERT(server->GetWordFrequencies(4) == expected.GetWordFrequencies(4));
+    }
+
+    // invalid batches add nothing
+    struct NewDocument {
+        int id;
+        string_view text;
+        DocumentStatus status;
+        vector<int> ratings;
+    };
+    const vector<vector<NewDocument>> invalid_batches = {
+        {{1'001, "new"sv, DocumentStatus::ACTUAL, {}}, {1'001, "new"sv, DocumentStatus::ACTUAL, {}}},
+        {{1'002, "new"sv, DocumentStatus::ACTUAL, {}}, {4, "new"sv, DocumentStatus::ACTUAL, {}}},
+        {{1'003, "new"sv, DocumentStatus::ACTUAL, {}}, {-1, "new"sv, DocumentStatus::ACTUAL, {}}},
+        {{1'004, "new"sv, DocumentStatus::ACTUAL, {}}, {1'005, "ne\x12w"sv, DocumentStatus::ACTUAL, {}}},
+    };
+    for (const auto& batch : invalid_batches) {
+        try {
+            par_server.AddDocuments(execution::par, batch);
+            ASSERT_HINT(false, "invalid batch must not be added"s);
+        } catch (const invalid_argument&) {
+        }
+        ASSERT_EQUAL(par_server.GetDocumentCount(), expected.GetDocumentCount());
+        ASSERT(par_server.FindTopDocuments("new"s).empty());
+    }
+}
+
+void TestTermDictionary() {
+    TermDictionary dictionary;
+    ASSERT_EQUAL(dictionary.Find("cat"sv), TermDictionary::NO_TERM);
+    vector<string_view> views;
+    for (int i = 0; i < 10'000; ++i) {
+        const string term = "w"s + to_string(i);
+        ASSERT_EQUAL(dictionary.Insert(term), static_cast<TermDictionary::TermId>(i));
+        views.push_back(dictionary.GetTerm(i));
+    }
+    ASSERT_EQUAL(dictionary.Insert(string(100'000, 'x')), 10'000u);
+    ASSERT_EQUAL(dictionary.size(), 10'001u);
+    // ids and views don't change on growth
+    for (int i = 0; i < 10'000; ++i) {
+        const string term = "w"s + to_string(i);
+        ASSERT_EQUAL(dictionary.Find(term), static_cast<TermDictionary::TermId>(i));
+        ASSERT_EQUAL(dictionary.Insert(term), static_cast<TermDictionary::TermId>(i));
+        ASSERT_EQUAL(views[i].data(), dictionary.GetTerm(i).data());
+        ASSERT_EQUAL(views[i], term);
+    }
+    ASSERT_EQUAL(dictionary.Find("w10000"sv), TermDictionary::NO_TERM);
+
+    // words of removed documents are not found anymore but may be added again
+    SearchServer server("in"s);
+    server.AddDocument(1, "cat in the city"s, DocumentStatus::ACTUAL, {1});
+    server.AddDocument(2, "dog"s, DocumentStatus::ACTUAL, {1});
+    server.RemoveDocument(1);
+    ASSERT(server.FindTopDocuments("cat"s).empty());
+    ASSERT(server.FindTopDocuments("dog -cat"s).size() == 1);
+    server.AddDocument(3, "black cat"s, DocumentStatus::ACTUAL, {1});
+    const auto docs = server.FindTopDocuments("cat city"s);
+    ASSERT_EQUAL(docs.size(), 1u);
+    ASSERT_EQUAL(docs[0].id, 3);
+    const auto [words, status] = server.MatchDocument("cat black city -in"s, 3);
+    ASSERT(words == vector<string_view>({"black"sv, "cat"sv}));
+}
+
+void TestInverseDocumentFreq() {
+    SearchServer server("and"s);
+    ASSERT_EQUAL(server.GetInverseDocumentFreq("cat"s), 0.0);
+    server.AddDocument(1, "cat and dog"s, DocumentStatus::ACTUAL, {1});
+    server.AddDocument(2, "cat"s, DocumentStatus::ACTUAL, {1});
+    server.AddDocuments(execution::par, vector<tuple<int, string, DocumentStatus, vector<int>>>{
+        {3, "bird"s, DocumentStatus::ACTUAL, {1}}, {4, "dog bird"s, DocumentStatus::BANNED, {1}}});
+    const auto check = [&server](const string& word, double expected) {
+        ASSERT_HINT(abs(server.GetInverseDocumentFreq(word) - expected) < RELEVANCE_EPS, word);
+    };
+    check("cat"s, log(4.0 / 2.0));
+    check("dog"s, log(4.0 / 2.0));
+    check("bird"s, log(4.0 / 2.0));
+    check("and"s, 0.0);
+
+    // weights are updated for the touched words and the document count
+    server.RemoveDocument(execution::par, 1);
+    check("cat"s, log(3.0 / 1.0));
+    check("dog"s, log(3.0 / 1.0));
+    server.RemoveDocument(2);
+    check("cat"s, 0.0);
+    check("bird"s, log(2.0 / 2.0));
+    server.AddDocument(5, "cat"s, DocumentStatus::ACTUAL, {1});
+    check("cat"s, log(3.0 / 1.0));
+    check("bird"s, log(3.0 / 2.0));
+    const auto docs = server.FindTopDocuments("cat"s);
+    ASSERT_EQUAL(docs.size(), 1u);
+    ASSERT(abs(docs[0].relevance - log(3.0)) < RELEVANCE_EPS);
+}
+
+void TestQueryParsing() {
+    SearchServer server("in the"s);
+    server.AddDocument(1, "cat in the city"s, DocumentStatus::ACTUAL, {1});
+    server.AddDocument(2, "dog in the city"s, DocumentStatus::ACTUAL, {2});
+    server.AddDocument(3, "cat and dog"s, DocumentStatus::ACTUAL, {3});
+
+    const auto get_ids = [&server](const string& query) {
+        vector<int> ids;
+        for (const Document& document : server.FindTopDocuments(query)) {
+            ids.push_back(document.id);
+        }
+        return ids;
+    };
+    // repeated words count once
+    const auto docs = server.FindTopDocuments("  cat city   cat -dog -dog in  "s);
+    const auto expected_docs = server.FindTopDocuments("cat city -dog"s);
+    ASSERT_EQUAL(docs.size(), 1u);
+    ASSERT_EQUAL(docs[0].id, 1);
+    ASSERT(abs(docs[0].relevance - expected_docs[0].relevance) < RELEVANCE_EPS);
+    // buffers of a long query don't leak into the next one
+    string long_query;
+    for (int i = 0; i < 100; ++i) {
+        long_query += "w"s + to_string(i) + " -cat "s;
+    }
+    ASSERT(get_ids(long_query + "city"s) == vector<int>{2});
+    ASSERT(get_ids("city"s).size() == 2);
+    ASSERT(get_ids("in the"s).empty());
+    ASSERT(get_ids(""s).empty());
+
+    for (const string& query : {"cat -"s, "cat --dog"s, "ca\x12t"s, "-do\x01g"s}) {
+        try {
+            server.FindTopDocuments(query);
+            ASSERT_HINT(false, query);
+        } catch (const invalid_argument&) {
+        }
+    }
+    // a failed query doesn't break the next one
+    ASSERT(get_ids("dog -city"s) == vector<int>{3});
+}
+
+void TestSplitIntoWords() {
+    // simple reference splitter
+    const auto split = [](const string& text) {
+        vector<string_view> words;
+        size_t begin = 0;
+        while (true) {
+            begin = text.find_first_not_of(' ', begin);
+            if (begin == string::npos) {
+                break;
+            }
+            const size_t end = min(text.find(' ', begin), text.size());
+            words.emplace_back(text.data() + begin, end - begin);
+            begin = end;
+        }
+        return words;
+    };
+    ASSERT(SplitIntoWords(""s).empty());
+    ASSERT(SplitIntoWords("   "s).empty());
+    ASSERT(SplitIntoWords(" a  bc "s) == vector<string>({"a"s, "bc"s}));
+    ASSERT(SplitIntoWordsView(" a  bc "sv) == vector<string_view>({"a"sv, "bc"sv}));
+
+    // texts of many lengths to cross block boundaries in every position
+    const string alphabet = "ab  \xd0\xb9 -"s;
+    for (int length = 0; length < 100; ++length) {
+        for (int seed = 0; seed < 20; ++seed) {
+            string text;
+            unsigned state = length * 31 + seed;
+            for (int i = 0; i < length; ++i) {
+                state = state * 1103515245 + 12345;
+                text += alphabet[(state >> 16) % alphabet.size()];
+            }
+            const string hint = to_string(length) + ":"s + to_string(seed);
+            vector<string_view> words;
+            ASSERT_HINT(SplitIntoWordsView(text, words), hint);
+            ASSERT_HINT(words == split(text), hint);
+            ASSERT_HINT(!HasControlCharacters(text), hint);
+            if (length > 0) {
+                string invalid_text = text;
+                invalid_text[(state >> 8) % length] = static_cast<char>(state % 32);
+                words.clear();
+                ASSERT_HINT(!SplitIntoWordsView(invalid_text, words), hint);
+                ASSERT_HINT(HasControlCharacters(invalid_text), hint);
+            }
+        }
+    }
+}
+
+void TestQueryCache() {
+    SearchServer server("and in"s);
+    SearchServer expected("and in"s);
+    for (int id = 0; id < 200; ++id) {
+        const string text = "cat w"s + to_string(id % 13) + (id % 4 ? " dog"s : " bird"s);
+        const DocumentStatus status = static_cast<DocumentStatus>(id % 3);
+        server.AddDocument(id, text, status, {id % 7});
+        expected.AddDocument(id, text, status, {id % 7});
+    }
+    server.SetQueryCacheCapacity(4);
+
+    const auto check = [&server, &expected](const string& query) {
+        for (const DocumentStatus status : {DocumentStatus::ACTUAL, DocumentStatus::BANNED}) {
+            const auto docs = server.FindTopDocuments(execution::par, query, status);
+            const auto expected_docs = expected.FindTopDocuments(query, status);
+            ASSERT_EQUAL_HINT(docs.size(), expected_docs.size(), query);
+            for (size_t i = 0; i < docs.size(); ++i) {
+                ASSERT_EQUAL_HINT(docs[i].id, expected_docs[i].id, query);
+                ASSERT_HINT(abs(docs[i].relevance - expected_docs[i].relevance) < RELEVANCE_EPS, query);
+            }
+        }
+        const auto window = server.FindTopDocuments(query, DocumentStatus::ACTUAL, 2, 3);
+        const auto expected_window = expected.FindTopDocuments(query, DocumentStatus::ACTUAL, 2, 3);
+        ASSERT_EQUAL_HINT(window.size(), expected_window.size(), query);
+        for (size_t i = 0; i < window.size(); ++i) {
+            ASSERT_EQUAL_HINT(window[i].id, expected_window[i].id, query);
+        }
+    };
+    // equal normalized queries share an entry; the cache is smaller than
+    // the set of queries, so entries are evicted
+    const vector<string> queries = {"cat w1"s, "w1 cat cat"s, "dog -w2"s, "-w2 in dog"s, "bird w3 -cat"s,
+                                    "w4 w5 w6"s, "w1 cat"s};
+    for (int i = 0; i < 3; ++i) {
+        for (const string& query : queries) {
+            check(query);
+        }
+    }
+    // changes of documents invalidate cached results
+    server.AddDocument(1'000, "cat w1 w1 w1"s, DocumentStatus::ACTUAL, {1});
+    expected.AddDocument(1'000, "cat w1 w1 w1"s, DocumentStatus::ACTUAL, {1});
+    check("cat w1"s);
+    server.RemoveDocument(execution::par, 1'000);
+    expected.RemoveDocument(1'000);
+    check("cat w1"s);
+    server.RemoveDocument(1);
+    expected.RemoveDocument(1);
+    check("cat w1"s);
+
+    // concurrent queries share the cache
+    vector<string> many_queries;
+    for (int i = 0; i < 500; ++i) {
+        many_queries.push_back(queries[i % queries.size()]);
+    }
+    const auto results = ProcessQueries(server, many_queries);
+    for (size_t i = 0; i < many_queries.size(); ++i) {
+        const auto expected_docs = expected.FindTopDocuments(many_queries[i]);
+        ASSERT_EQUAL(results[i].size(), expected_docs.size());
+        for (size_t j = 0; j < results[i].size(); ++j) {
+            ASSERT_EQUAL(results[i][j].id, expected_docs[j].id);
+        }
+    }
+
+    server.SetQueryCacheCapacity(0);
+    check("dog -w2"s);
+}
+
+void TestConcurrentReadsAndWrites() {
+    SearchServer server("and"s);
+    server.SetQueryCacheCapacity(16);
+    // not all documents have "cat", so its relevance is positive
+    server.AddDocument(20'000, "dog"s, DocumentStatus::ACTUAL, {1});
+    const int batch_count = 60;
+    const int batch_size = 10;
+    // readers check that every batch is seen as a whole; single documents
+    // are added and removed meanwhile
+    atomic<bool> done = false;
+    atomic<int> failures = 0;
+    vector<thread> readers;
+    for (int reader = 0; reader < 3; ++reader) {
+        readers.emplace_back([&server, &done, &failures]() {
+            while (!done) {
+                server.FindTopDocuments(execution::par, "dog"s);
+                const auto docs = server.FindTopDocuments("cat batch"s, DocumentStatus::ACTUAL, 0, 1000);
+                if (docs.size() % batch_size != 0) {
+                    ++failures;
+                }
+                for (const Document& document : docs) {
+                    if (document.relevance <= 0.0) {
+                        ++failures;
+                    }
+                }
+                // ids are a consistent copy: sorted, with whole batches
+                const vector<int> ids = server.GetDocumentIds();
+                const auto batch_end = lower_bound(ids.begin(), ids.end(), 10'000);
+                if (!is_sorted(ids.begin(), ids.end()) || (batch_end - ids.begin()) % batch_size != 0) {
+                    ++failures;
+                }
+            }
+        });
+    }
+    for (int batch = 0; batch < batch_count; ++batch) {
+        vector<tuple<int, string, DocumentStatus, vector<int>>> documents;
+        for (int i = 0; i < batch_size; ++i) {
+            documents.emplace_back(batch * batch_size + i, "cat and batch w"s + to_string(batch),
+                                   DocumentStatus::ACTUAL, vector<int>{i});
+        }
+        if (batch % 2 == 0) {
+            server.AddDocuments(execution::par, documents);
+        } else {
+            server.AddDocuments(documents);
+        }
+        server.AddDocument(10'000 + batch, "dog"s, DocumentStatus::ACTUAL, {1});
+        if (batch % 3 == 2) {
+            server.RemoveDocument(execution::par, 10'000 + batch - 1);
+        }
+    }
+    done = true;
+    for (thread& reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQUAL(failures.load(), 0);
+    ASSERT_EQUAL(server.GetDocumentCount(), batch_count * batch_size + batch_count - batch_count / 3 + 1);
+    const auto [words, status] = server.MatchDocument("cat w0 w5"s, 5);
+    ASSERT(words == vector<string_view>({"cat"sv, "w0"sv}));
+}
+
+void TestIndexCompaction() {
+    const auto make_text = [](int id) {
+        string text = "cat"s;
+        for (int i = 0; i < 20; ++i) {
+            text += " w"s + to_string((id + i) % 37);
+        }
+        return text;
+    };
+    SearchIndex index;
+    SearchServer server;
+    SearchIndex expected;
+    for (int id = 0; id < 400; ++id) {
+        index.AddDocument(id, make_text(id), DocumentStatus::ACTUAL, {id % 9});
+        server.AddDocument(id, make_text(id), DocumentStatus::ACTUAL, {id % 9});
+        if (id % 8 >= 5) {
+            expected.AddDocument(id, make_text(id), DocumentStatus::ACTUAL, {id % 9});
+        }
+    }
+    for (int id = 0; id < 400; ++id) {
+        if (id % 8 < 5) {
+            index.RemoveDocument(id);
+            // the server compacts its index on the worker thread meanwhile
+            server.RemoveDocument(execution::par, id);
+        }
+    }
+    ASSERT(index.NeedsCompaction());
+
+    const auto check = [&expected](const auto& index) {
+        ASSERT_EQUAL(index.GetDocumentCount(), expected.GetDocumentCount());
+        for (const string& query : {"cat"s, "w1 w7 -w3"s, "w5 w36 cat"s}) {
+            const auto docs = index.FindTopDocuments(query, DocumentStatus::ACTUAL, 0, 1000);
+            const auto expected_docs = expected.FindTopDocuments(query, DocumentStatus::ACTUAL, 0, 1000);
+            ASSERT_EQUAL_HINT(docs.size(), expected_docs.size(), query);
+            for (size_t i = 0; i < docs.size(); ++i) {
+                ASSERT_EQUAL_HINT(docs[i].id, expected_docs[i].id, query);
+                ASSERT_HINT(abs(docs[i].relevance - expected_docs[i].relevance) < RELEVANCE_EPS, query);
+            }
+        }
+        ASSERT_EQUAL(index.GetInverseDocumentFreq("w3"s), expected.GetInverseDocumentFreq("w3"s));
+        ASSERT(index.GetWordFrequencies(7) == expected.GetWordFrequencies(7));
+        ASSERT(get<0>(index.MatchDocument("w7 w8"s, 7)) == get<0>(expected.MatchDocument("w7 w8"s, 7)));
+    };
+    check(index);
+    check(server);
+    index.Compact();
+    ASSERT(!index.NeedsCompaction());
+    check(index);
+
+    // removed documents don't come back after adding new ones
+    index.AddDocument(1'000, "cat w1"s, DocumentStatus::ACTUAL, {1});
+    expected.AddDocument(1'000, "cat w1"s, DocumentStatus::ACTUAL, {1});
+    server.AddDocument(1'000, "cat w1"s, DocumentStatus::ACTUAL, {1});
+    check(index);
+    check(server);
+}
+
+void TestRemoveDocuments() {
+    const auto make_text = [](int id) {
+        string text = "cat"s;
+        for (int i = 0; i < 10; ++i) {
+            text += " w"s + to_string((id * 3 + i) % 41);
+        }
+        // a word which only removed documents have
+        if (id % 10 == 3) {
+            text += " gone"s;
+        }
+        return text;
+    };
+    SearchIndex seq_index;
+    SearchIndex par_index;
+    SearchIndex single_index;
+    SearchIndex expected;
+    vector<int> ids_to_remove;
+    for (int id = 0; id < 2000; ++id) {
+        for (SearchIndex* index : {&seq_index, &par_index, &single_index}) {
+            index->AddDocument(id, make_text(id), DocumentStatus::ACTUAL, {id % 7});
+        }
+        if (id % 10 == 3 || id % 4 == 0) {
+            ids_to_remove.push_back(id);
+        } else {
+            expected.AddDocument(id, make_text(id), DocumentStatus::ACTUAL, {id % 7});
+        }
+    }
+    // unknown and repeated ids are skipped
+    ids_to_remove.push_back(5000);
+    ids_to_remove.push_back(ids_to_remove.front());
+
+    seq_index.RemoveDocuments(ids_to_remove);
+    par_index.RemoveDocuments(execution::par, ids_to_remove);
+    for (const int id : ids_to_remove) {
+        single_index.RemoveDocument(id);
+    }
+
+    const auto check = [&expected](const SearchIndex& index) {
+        ASSERT_EQUAL(index.GetDocumentCount(), expected.GetDocumentCount());
+        ASSERT(vector<int>(index.begin(), index.end()) == vector<int>(expected.begin(), expected.end()));
+        for (const string& word : {"cat"s, "w0"s, "w17"s, "gone"s}) {
+            ASSERT_HINT(abs(index.GetInverseDocumentFreq(word) - expected.GetInverseDocumentFreq(word)) < RELEVANCE_EPS, word);
+        }
+        for (const string& query : {"cat"s, "w1 w7 -w3"s, "gone"s, "w5 gone"s}) {
+            const auto docs = index.FindTopDocuments(query, DocumentStatus::ACTUAL, 0, 2000);
+            const auto expected_docs = expected.FindTopDocuments(query, DocumentStatus::ACTUAL, 0, 2000);
+            ASSERT_EQUAL_HINT(docs.size(), expected_docs.size(), query);
+            for (size_t i = 0; i < docs.size(); ++i) {
+                ASSERT_EQUAL_HINT(docs[i].id, expected_docs[i].id, query);
+                ASSERT_HINT(abs(docs[i].relevance - expected_docs[i].relevance) < RELEVANCE_EPS, query);
+            }
+        }
+    };
+    for (SearchIndex* index : {&seq_index, &par_index, &single_index}) {
+        check(*index);
+        ASSERT(index->NeedsCompaction());
+        index->Compact();
+        check(*index);
+    }
+
+    SearchServer server;
+    for (int id = 0; id < 10; ++id) {
+        server.AddDocument(id, make_text(id), DocumentStatus::ACTUAL, {1});
+    }
+    server.RemoveDocuments(execution::par, vector<int>{1, 3, 5});
+    ASSERT(server.GetDocumentIds() == (vector<int>{0, 2, 4, 6, 7, 8, 9}));
+    ASSERT(server.FindTopDocuments("gone"s).empty());
+}
+
+void TestRemoveDuplicates() {
+    SearchServer server("and with"s);
+    server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    // same words as 2: repeated, reordered, with stop words, other status
+    server.AddDocument(3, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    server.AddDocument(4, "funny pet and curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    server.AddDocument(5, "funny funny pet and nasty nasty rat"s, DocumentStatus::BANNED, {1, 2});
+    server.AddDocument(6, "funny pet and not very nasty rat"s, DocumentStatus::ACTUAL, {1, 2});
+    server.AddDocument(7, "very nasty rat and not very funny pet"s, DocumentStatus::ACTUAL, {1, 2});
+    server.AddDocument(8, "pet with rat and rat and rat"s, DocumentStatus::ACTUAL, {1, 2});
+    server.AddDocument(9, "nasty rat with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    server.AddDocument(10, ""s, DocumentStatus::ACTUAL, {});
+    server.AddDocument(11, "and with"s, DocumentStatus::ACTUAL, {});
+
+    ASSERT(RemoveDuplicates(server) == (vector<int>{3, 4, 5, 7, 11}));
+    ASSERT(server.GetDocumentIds() == (vector<int>{1, 2, 6, 8, 9, 10}));
+    ASSERT(RemoveDuplicates(server).empty());
+
+    // groups of documents of 20 words without common words between groups:
+    // documents of even groups differ in a word, so their similarity is
+    // 19 / 21; documents of odd groups differ in 5 words, similarity 15 / 25
+    SearchServer near_server;
+    vector<int> expected;
+    for (int group = 0; group < 50; ++group) {
+        const int changed_words = group % 2 == 0 ? 1 : 5;
+        for (int i = 0; i < 3; ++i) {
+            const int id = group * 3 + i;
+            string text;
+            for (int word = 0; word < 20; ++word) {
+                const int variant = word < changed_words ? 100 * (i + 1) + word : word;
+                text += " g"s + to_string(group) + "w"s + to_string(variant);
+            }
+            near_server.AddDocument(id, text, DocumentStatus::ACTUAL, {1});
+            if (i > 0 && group % 2 == 0) {
+                expected.push_back(id);
+            }
+        }
+    }
+    ASSERT(near_server.FindNearDuplicateDocuments(1.0).empty());
+    ASSERT(RemoveNearDuplicates(near_server, 0.9) == expected);
+    ASSERT_EQUAL(near_server.GetDocumentCount(), 100);
+    try {
+        near_server.FindNearDuplicateDocuments(0.0);
+        ASSERT_HINT(false, "similarity 0 must throw"s);
+    } catch (const invalid_argument&) {
+    }
+}
+
+void TestLatencyHistogram() {
+    LatencyHistogram histogram;
+    ASSERT_EQUAL(histogram.GetQuantile(0.5).count(), 0);
+    for (int value = 1; value <= 1000; ++value) {
+        histogram.Record(chrono::microseconds(value));
+    }
+    ASSERT_EQUAL(histogram.GetCount(), 1000u);
+    // buckets are 1/16 of a power of two wide
+    for (const double quantile : {0.01, 0.5, 0.9, 0.99, 1.0}) {
+        const double expected = quantile * 1000 * 1000;
+        const double value = static_cast<double>(histogram.GetQuantile(quantile).count());
+        ASSERT_HINT(value >= expected && value <= expected * (1.0 + 1.0 / 16), to_string(quantile));
+    }
+    histogram.Record(chrono::nanoseconds(5));
+    ASSERT_EQUAL(histogram.GetQuantile(0.0).count(), 5);
+    histogram.Remove(chrono::nanoseconds(5));
+    LatencyHistogram other;
+    other.Record(chrono::seconds(1));
+    histogram.Merge(other);
+    ASSERT_EQUAL(histogram.GetCount(), 1001u);
+    ASSERT(histogram.GetQuantile(1.0) >= chrono::seconds(1));
+    ASSERT(histogram.GetQuantile(0.999) < chrono::milliseconds(2));
+}
+
+void TestRequestQueue() {
+    SearchServer server("and in at"s);
+    server.AddDocument(1, "curly cat curly tail"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    server.AddDocument(2, "curly dog and fancy collar"s, DocumentStatus::ACTUAL, {1, 2, 3});
+    server.AddDocument(3, "big cat fancy collar "s, DocumentStatus::ACTUAL, {1, 2, 8});
+    server.AddDocument(4, "big dog sparrow Eugene"s, DocumentStatus::ACTUAL, {1, 3, 2});
+    server.AddDocument(5, "big dog sparrow Vasiliy"s, DocumentStatus::ACTUAL, {1, 1, 1});
+    RequestQueue request_queue(server);
+    for (int i = 0; i < 1439; ++i) {
+        request_queue.AddFindRequest("empty request"s);
+    }
+    request_queue.AddFindRequest("curly dog"s);
+    ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1439);
+    // the first requests leave the window
+    request_queue.AddFindRequest("big collar"s);
+    ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1438);
+    request_queue.AddFindRequest("sparrow"s, DocumentStatus::ACTUAL);
+    request_queue.AddFindRequest("sparrow"s, [](int id, DocumentStatus, int) {
+        return id == 4;
+    });
+    ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1436);
+
+    RequestQueue::Statistics statistics = request_queue.GetStatistics();
+    ASSERT_EQUAL(statistics.request_count, 1440);
+    ASSERT_EQUAL(statistics.no_result_request_count, 1436);
+    ASSERT_EQUAL(statistics.result_counts[0], 1436);
+    ASSERT_EQUAL(statistics.result_counts[1], 1);
+    ASSERT_EQUAL(statistics.result_counts[2], 1);
+    ASSERT_EQUAL(statistics.result_counts[3], 0);
+    ASSERT_EQUAL(statistics.result_counts[4], 2);
+    ASSERT_EQUAL(statistics.latencies.GetCount(), 1440u);
+
+    // results are given back
+    const vector<Document> documents = request_queue.AddQueryResult(
+        vector<Document>{{1, 0.5, 1}, {2, 0.5, 1}}, chrono::milliseconds(3));
+    ASSERT_EQUAL(documents.size(), 2u);
+    ASSERT(request_queue.GetStatistics().latencies.GetQuantile(1.0) >= chrono::milliseconds(3));
+
+    // requests from several threads
+    RequestQueue shared_queue(server);
+    vector<thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&shared_queue]() {
+            for (int i = 0; i < 500; ++i) {
+                shared_queue.AddFindRequest(i % 2 == 0 ? "cat"s : "unknown"s);
+            }
+        });
+    }
+    for (thread& thread : threads) {
+        thread.join();
+    }
+    statistics = shared_queue.GetStatistics();
+    ASSERT_EQUAL(statistics.request_count, 1440);
+    int total = 0;
+    for (const int count : statistics.result_counts) {
+        total += count;
+    }
+    ASSERT_EQUAL(total, 1440);
+    ASSERT_EQUAL(statistics.no_result_request_count, statistics.result_counts[0]);
+    ASSERT_EQUAL(statistics.result_counts[2] + statistics.result_counts[0], 1440);
+}
+
+void TestStageLatency() {
+#ifdef ENABLE_STAGE_LATENCY
+    StageLatencyRegistry& registry = StageLatencyRegistry::Instance();
+    registry.Reset();
+    SearchServer server;
+    for (int id = 0; id < 100; ++id) {
+        server.AddDocument(id, "cat w"s + to_string(id % 7), DocumentStatus::ACTUAL, {1});
+    }
+    server.FindTopDocuments("cat -w1"s);
+    server.FindTopDocuments(execution::par, "w2 w3"s);
+    server.MatchDocument("cat"s, 5);
+    ProcessQueries(server, {"cat"s, "w4 -w5"s});
+    for (const QueryStage stage : {QueryStage::PARSE, QueryStage::POSTING_FETCH, QueryStage::MINUS_FILTERING,
+                                   QueryStage::SCORING, QueryStage::TOP_K, QueryStage::RESULT_BUILD}) {
+        ASSERT_HINT(registry.GetHistogram(stage).GetCount() >= 4, string(GetQueryStageName(stage)));
+    }
+    ASSERT_EQUAL(registry.GetHistogram(QueryStage::FIND_TOP_DOCUMENTS).GetCount(), 2u);
+    ASSERT_EQUAL(registry.GetHistogram(QueryStage::MATCH_DOCUMENT).GetCount(), 1u);
+    ASSERT_EQUAL(registry.GetHistogram(QueryStage::PROCESS_QUERIES).GetCount(), 1u);
+
+    // records of finished threads are kept
+    vector<thread> threads;
+    for (int t = 0; t < 3; ++t) {
+        threads.emplace_back([&server]() {
+            for (int i = 0; i < 10; ++i) {
+                server.MatchDocument("w1"s, i);
+            }
+        });
+    }
+    for (thread& thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQUAL(registry.GetHistogram(QueryStage::MATCH_DOCUMENT).GetCount(), 31u);
+
+    // stages of the stripes of a parallel search make a sample per request
+    SearchServer large_server;
+    for (int id = 0; id < 3 * 4096; ++id) {
+        large_server.AddDocument(id, "cat w"s + to_string(id % 7), DocumentStatus::ACTUAL, {1});
+    }
+    registry.Reset();
+    large_server.FindTopDocuments(execution::par, "cat -w1"s);
+    for (const QueryStage stage : {QueryStage::MINUS_FILTERING, QueryStage::SCORING,
+                                   QueryStage::TOP_K, QueryStage::RESULT_BUILD}) {
+        ASSERT_EQUAL_HINT(registry.GetHistogram(stage).GetCount(), 1u, string(GetQueryStageName(stage)));
+    }
+
+    ostringstream output;
+    registry.Dump(output);
+    ASSERT(output.str().find("parse: count "s) != string::npos);
+    ASSERT(output.str().find("p999"s) != string::npos);
+    registry.Reset();
+    ASSERT_EQUAL(registry.GetHistogram(QueryStage::PARSE).GetCount(), 0u);
+#endif
+}
+
+void TestProcessQueries() {
+    SearchServer server("and with"s);
+    for (int id = 0; id < 300; ++id) {
+        string text = "cat"s;
+        for (int i = 0; i < id % 9; ++i) {
+            text += " w"s + to_string((id * 7 + i) % 23);
+        }
+        server.AddDocument(id, text, static_cast<DocumentStatus>(id % 3 ? 0 : 2), {id % 5});
+    }
+    // queries from 1 to 70 words with shared, repeated, unknown, stop and
+    // minus words
+    vector<string> queries = {""s, "cat"s, "and"s, "unknown"s, "w1 w1 -w2 w2"s, "-cat w3"s};
+    for (int size = 1; size <= 70; size += 3) {
+        string query;
+        for (int i = 0; i < size; ++i) {
+            query += (i % 5 == 4 ? " -w"s : " w"s) + to_string((size + i * 3) % 29);
+        }
+        queries.push_back(query);
+    }
+
+    const auto check = [&server, &queries]() {
+        const auto results = ProcessQueries(server, queries);
+        ASSERT_EQUAL(results.size(), queries.size());
+        size_t total = 0;
+        for (size_t i = 0; i < queries.size(); ++i) {
+            const auto expected = server.FindTopDocuments(queries[i]);
+            ASSERT_EQUAL_HINT(results[i].size(), expected.size(), queries[i]);
+            for (size_t j = 0; j < expected.size(); ++j) {
+                ASSERT_EQUAL_HINT(results[i][j].id, expected[j].id, queries[i]);
+                ASSERT_HINT(abs(results[i][j].relevance - expected[j].relevance) < RELEVANCE_EPS, queries[i]);
+            }
+            total += expected.size();
+        }
+        size_t joined_size = 0;
+        for (const Document& document : ProcessQueriesJoined(server, queries)) {
+            (void)document;
+            ++joined_size;
+        }
+        ASSERT_EQUAL(joined_size, total);
+    };
+    check();
+    server.SetQueryCacheCapacity(100);
+    check();
+    check();
+
+    queries.push_back("cat --w1"s);
+    try {
+        ProcessQueries(server, queries);
+        ASSERT_HINT(false, "invalid query must throw"s);
+    } catch (const invalid_argument&) {
+    }
+}
+
+void TestProcessQueriesStream() {
+    SearchServer server;
+    for (int id = 0; id < 100; ++id) {
+        server.AddDocument(id, "w"s + to_string(id % 7) + " w"s + to_string(id % 11), DocumentStatus::ACTUAL, {id});
+    }
+    vector<string> queries;
+    for (int i = 0; i < 50; ++i) {
+        queries.push_back("w"s + to_string(i % 13) + " -w"s + to_string(i % 5));
+    }
+    const auto expected = ProcessQueries(server, queries);
+
+    for (const size_t window : {size_t{0}, size_t{1}, size_t{7}, size_t{50}, size_t{1000}}) {
+        size_t next_index = 0;
+        ProcessQueriesStream(server, queries, [&](size_t index, vector<Document>&& documents) {
+            ASSERT_EQUAL(index, next_index);
+            ASSERT_EQUAL(documents.size(), expected[index].size());
+            for (size_t j = 0; j < documents.size(); ++j) {
+                ASSERT_EQUAL(documents[j].id, expected[index][j].id);
+            }
+            ++next_index;
+        }, window);
+        ASSERT_EQUAL(next_index, queries.size());
+    }
+
+    size_t count = 0;
+    ProcessQueriesStream(server, vector<string>{}, [&count](size_t, vector<Document>&&) {
+        ++count;
+    });
+    ASSERT_EQUAL(count, 0u);
+
+    // results before the window of an invalid query are given
+    queries[30] = "w1 --w2"s;
+    try {
+        ProcessQueriesStream(server, queries, [&count](size_t, vector<Document>&&) {
+            ++count;
+        }, 10);
+        ASSERT_HINT(false, "invalid query must throw"s);
+    } catch (const invalid_argument&) {
+    }
+    ASSERT_EQUAL(count, 30u);
+}
+
 // Функция TestSearchServer является точкой входа для запуска тестов
 void TestSearchServer() {
     RUN_TEST(TestExcludeStopWordsFromAddedDocumentContent);
     RUN_TEST(TestAddDocument);
     RUN_TEST(TestStopWords);
     RUN_TEST(TestMinusWords);
+    RUN_TEST(TestMinusWordsExclusion);
     RUN_TEST(TestMatchDocument2);
+    RUN_TEST(TestMatchDocuments);
     RUN_TEST(TestRelevanceSort);
     RUN_TEST(TestDocumentRating);
     RUN_TEST(TestUserPredicate);
     RUN_TEST(TestStatusFilter);
     RUN_TEST(TestRelevanceValue);
+    RUN_TEST(TestSparseDocumentIds);
+    RUN_TEST(TestParallelFindTopDocuments);
+    RUN_TEST(TestFindTopDocumentsWindow);
+    RUN_TEST(TestTopDocumentsPruning);
+    RUN_TEST(TestCompressedPostings);
+    RUN_TEST(TestSnapshot);
+    RUN_TEST(TestSnapshotCorruption);
+    RUN_TEST(TestAddDocuments);
+    RUN_TEST(TestTermDictionary);
+    RUN_TEST(TestInverseDocumentFreq);
+    RUN_TEST(TestQueryParsing);
+    RUN_TEST(TestSplitIntoWords);
+    RUN_TEST(TestQueryCache);
+    RUN_TEST(TestConcurrentReadsAndWrites);
+    RUN_TEST(TestIndexCompaction);
+    RUN_TEST(TestRemoveDocuments);
+    RUN_TEST(TestRemoveDuplicates);
+    RUN_TEST(TestLatencyHistogram);
+    RUN_TEST(TestRequestQueue);
+    RUN_TEST(TestStageLatency);
+    RUN_TEST(TestProcessQueries);
+    RUN_TEST(TestProcessQueriesStream);
 }
 